@@ -0,0 +1,858 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Benchmark driver for the BinarySearchTree implementation.
+ */
+/*-----------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include "bstree.h"
+#include "bstree_visitor.h"
+#include "buckettree.h"
+#include "nodepool.h"
+#include "queryexecutor.h"
+#include "shardedtree.h"
+#include "wal.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/** Default number of nodes of the benchmarked trees. */
+#define DEFAULT_SIZE 10000000
+
+/*------------------------  Tools  -----------------------------*/
+
+/** Current time in seconds, from a monotonic clock. */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** The i-th key of a pseudo random sequence of distinct keys spread over the int range.
+ * This is the finalizer of MurmurHash3, a bijection on 32 bits integers, so the keys are all different.
+ */
+static int bench_key(unsigned int i) {
+    i ^= i >> 16;
+    i *= 0x85ebca6bu;
+    i ^= i >> 13;
+    i *= 0xc2b2ae35u;
+    i ^= i >> 16;
+    return (int)i;
+}
+
+/** Builds a tree with n distinct keys inserted in pseudo random order. */
+static BinarySearchTree* build_tree(int n) {
+    BinarySearchTree* t = bstree_create();
+    double start = now();
+    for (int i = 0; i < n; ++i)
+        bstree_add(&t, bench_key(i));
+    printf("\tbuilt a tree of %d nodes in %.3f s\n", n, now() - start);
+    return t;
+}
+
+/** Prints one timing line. */
+static void report(const char* label, double seconds, long long result) {
+    printf("\t%-40s %10.2f ms  (result %lld)\n", label, seconds * 1e3, result);
+}
+
+/*------------------------  Visitors  -----------------------------*/
+
+/** Environment of the "find first key greater than" query. */
+typedef struct {
+    int threshold;
+    long long found;
+    long long visited;
+} FindEnv;
+
+static void count_node(const BinarySearchTree* t, void* env) {
+    (void)t;
+    ++*(long long*)env;
+}
+
+static VisitAction count_node_until(const BinarySearchTree* t, void* env) {
+    (void)t;
+    ++*(long long*)env;
+    return visit_continue;
+}
+
+/** Environment of the level statistics : the widest level. */
+typedef struct {
+    int depth;
+    size_t width;
+} LevelStats;
+
+static void widest_level(int depth, size_t width, void* env) {
+    LevelStats* s = env;
+    if (width > s->width) {
+        s->depth = depth;
+        s->width = width;
+    }
+}
+
+static inline void count_node_inline(const BinarySearchTree* t, void* env) {
+    (void)t;
+    ++*(long long*)env;
+}
+
+/* With a plain OperateFunctor, the visit cannot be stopped : every node is processed. */
+static void find_greater(const BinarySearchTree* t, void* env) {
+    FindEnv* e = env;
+    ++e->visited;
+    if (e->found < 0 && bstree_key(t) > e->threshold)
+        e->found = bstree_key(t);
+}
+
+static VisitAction find_greater_until(const BinarySearchTree* t, void* env) {
+    FindEnv* e = env;
+    ++e->visited;
+    if (bstree_key(t) > e->threshold) {
+        e->found = bstree_key(t);
+        return visit_stop;
+    }
+    return visit_continue;
+}
+
+static inline VisitAction find_greater_inline(const BinarySearchTree* t, void* env) {
+    FindEnv* e = env;
+    ++e->visited;
+    if (bstree_key(t) > e->threshold) {
+        e->found = bstree_key(t);
+        return visit_stop;
+    }
+    return visit_continue;
+}
+
+BSTREE_DEFINE_DEPTH_INFIX(count_infix_inlined, count_node_inline)
+BSTREE_DEFINE_DEPTH_INFIX_UNTIL(find_greater_inlined, find_greater_inline)
+
+static void bench_visitors(int n) {
+    BinarySearchTree* t = build_tree(n);
+    double start;
+    long long count;
+
+    count = 0;
+    start = now();
+    bstree_depth_infix(t, count_node, &count);
+    report("full walk, OperateFunctor", now() - start, count);
+
+    count = 0;
+    start = now();
+    count_infix_inlined(t, &count);
+    report("full walk, inlined visitor", now() - start, count);
+
+    /* The answer is at the median of the keys : the full walk processes all the nodes. */
+    FindEnv env = { 0, -1, 0 };
+    start = now();
+    bstree_depth_infix(t, find_greater, &env);
+    report("find first > median, OperateFunctor", now() - start, env.found);
+
+    env.found = -1; env.visited = 0;
+    start = now();
+    bstree_depth_infix_until(t, find_greater_until, &env);
+    report("find first > median, ControlFunctor", now() - start, env.found);
+
+    env.found = -1; env.visited = 0;
+    start = now();
+    find_greater_inlined(t, &env);
+    report("find first > median, inlined visitor", now() - start, env.found);
+
+    count = 0;
+    start = now();
+    bstree_iterative_breadth_until(t, count_node_until, &count);
+    report("breadth first, ControlFunctor", now() - start, count);
+
+    count = 0;
+    start = now();
+    bstree_iterative_breadth(t, count_node, &count);
+    report("breadth first, circular array", now() - start, count);
+
+    LevelStats stats = { 0, 0 };
+    start = now();
+    bstree_breadth_levels(t, NULL, widest_level, &stats);
+    report("widest level, level functor", now() - start, (long long)stats.width);
+
+    /* Many visits of small subtrees : the cost of allocating the pending nodes at each visit becomes visible. */
+    const BinarySearchTree* small = t;
+    for (int depth = bstree_height(t) - 8; depth > 0 && !bstree_empty(bstree_left(small)); --depth)
+        small = bstree_left(small);
+    const int visits = 10000;
+    count = 0;
+    start = now();
+    for (int i = 0; i < visits; ++i) {
+        bstree_iterative_breadth(small, count_node, &count);
+        bstree_iterative_depth_infix(small, count_node, &count);
+    }
+    report("small visits, allocated memory", now() - start, count);
+
+    BSTreeTraversal* traversal = bstree_traversal_create(0);
+    count = 0;
+    start = now();
+    for (int i = 0; i < visits; ++i) {
+        bstree_traversal_breadth(traversal, small, count_node, NULL, &count);
+        bstree_traversal_depth_infix(traversal, small, count_node, &count);
+    }
+    report("small visits, reused traversal", now() - start, count);
+    bstree_traversal_delete(&traversal);
+
+    bstree_delete(&t);
+}
+
+/*------------------------  Sharded trees  -----------------------------*/
+
+typedef struct {
+    ShardedTree* tree;
+    int first;
+    int stride;
+    int n;
+    /* if true, keys are concentrated in a range of 2^21 values, so that one shard is hot */
+    bool skewed;
+} WriterEnv;
+
+static void* writer(void* env) {
+    WriterEnv* e = env;
+    for (int i = e->first; i < e->n; i += e->stride) {
+        int key = bench_key(i);
+        sharded_add(e->tree, e->skewed ? key >> 11 : key);
+    }
+    return NULL;
+}
+
+/* Inserts n keys with nb_threads writers in a tree of nb_shards shards, returns the elapsed time */
+static double run_writers(ShardedTree* st, int nb_threads, int n, bool skewed) {
+    pthread_t threads[16];
+    WriterEnv envs[16];
+    double start = now();
+    for (int t = 0; t < nb_threads; ++t) {
+        envs[t] = (WriterEnv){ st, t, nb_threads, n, skewed };
+        pthread_create(&threads[t], NULL, writer, &envs[t]);
+    }
+    for (int t = 0; t < nb_threads; ++t)
+        pthread_join(threads[t], NULL);
+    return now() - start;
+}
+
+static void bench_sharded(int n) {
+    static const unsigned int shards[] = { 1, 16 };
+    static const int threads[] = { 1, 2, 4, 8 };
+    char label[64];
+
+    for (unsigned int s = 0; s < sizeof(shards) / sizeof(shards[0]); ++s) {
+        for (unsigned int t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+            ShardedTree* st = sharded_create(shards[s], false);
+            double seconds = run_writers(st, threads[t], n, false);
+            snprintf(label, sizeof(label), "%2u shards, %d writers", shards[s], threads[t]);
+            report(label, seconds, (long long)sharded_size(st));
+            sharded_delete(&st);
+        }
+    }
+
+    /* All the keys fall in the range of one shard at first : the boundaries must move */
+    ShardedTree* st = sharded_create(16, false);
+    double seconds = run_writers(st, 4, n, true);
+    report("16 shards, 4 writers, skewed keys", seconds, (long long)sharded_size(st));
+    printf("\tshard sizes :");
+    for (unsigned int i = 0; i < sharded_nb_shards(st); ++i)
+        printf(" %zu", sharded_shard_size(st, i));
+    printf("\n");
+    sharded_delete(&st);
+}
+
+/*------------------------  Balancing engines  -----------------------------*/
+
+static void bench_engines(int n) {
+    static const struct {
+        BalancingPolicy policy;
+        const char* name;
+    } engines[] = {
+        { balancing_redblack, "red-black" },
+        { balancing_avl, "AVL" },
+        { balancing_treap, "treap" },
+        { balancing_llrb, "left-leaning red-black" },
+        { balancing_redblack_topdown, "top-down red-black" },
+    };
+    char label[64];
+
+    for (unsigned int e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+        BSTreeOptions options;
+        bstree_default_options(&options);
+        options.balancing = engines[e].policy;
+        BSTreeHandle* h = bstree_handle_create(&options);
+
+        double start = now();
+        for (int i = 0; i < n; ++i)
+            bstree_handle_add(h, bench_key(i));
+        double insert = now() - start;
+        int height = bstree_height(bstree_handle_root(h));
+        long long size = (long long)bstree_handle_size(h);
+
+        long long found = 0;
+        start = now();
+        for (int i = 0; i < n; ++i)
+            found += !bstree_empty(bstree_handle_search(h, bench_key((unsigned int)i * 7919u % (unsigned int)n)));
+        double search = now() - start;
+
+        start = now();
+        for (int i = 0; i < n; i += 2)
+            bstree_handle_remove(h, bench_key(i));
+        double removal = now() - start;
+
+        printf("\t%s : height %d for %lld nodes\n", engines[e].name, height, size);
+        snprintf(label, sizeof(label), "  %d insertions", n);
+        report(label, insert, size);
+        snprintf(label, sizeof(label), "  %d searches", n);
+        report(label, search, found);
+        snprintf(label, sizeof(label), "  %d removals", (n + 1) / 2);
+        report(label, removal, (long long)bstree_handle_size(h));
+        bstree_handle_delete(&h);
+    }
+}
+
+/*------------------------  Top-down insertion  -----------------------------*/
+
+/* Inserts n keys in a red-black tree using the given engine, keys are random or increasing */
+static void run_insertions(BalancingPolicy policy, const char* name, int n, bool increasing) {
+    BSTreeOptions options;
+    bstree_default_options(&options);
+    options.balancing = policy;
+    BSTreeHandle* h = bstree_handle_create(&options);
+    char label[64];
+
+    double start = now();
+    for (int i = 0; i < n; ++i)
+        bstree_handle_add(h, increasing ? i : bench_key(i));
+    double seconds = now() - start;
+
+    snprintf(label, sizeof(label), "%s, %s keys", name, increasing ? "increasing" : "random");
+    report(label, seconds, bstree_height(bstree_handle_root(h)));
+    bstree_handle_delete(&h);
+}
+
+static void bench_topdown(int n) {
+    printf("\tinsertion time, the result is the height of the tree\n");
+    run_insertions(balancing_redblack, "bottom-up", n, false);
+    run_insertions(balancing_redblack_topdown, "top-down", n, false);
+    run_insertions(balancing_redblack, "bottom-up", n, true);
+    run_insertions(balancing_redblack_topdown, "top-down", n, true);
+}
+
+/*------------------------  Bounded trees  -----------------------------*/
+
+/* Bounded tree used as a cache of the recent keys : a key is accessed, and added when it is missing */
+static void bench_bounded(int n) {
+    static const struct {
+        EvictionPolicy policy;
+        const char* name;
+    } policies[] = {
+        { eviction_oldest, "oldest" },
+        { eviction_lru, "least recently used" },
+        { eviction_smallest, "smallest key" },
+    };
+    char label[64];
+    /* Keys are drawn from a set 4 times larger than the capacity, with a hot subset getting half the accesses */
+    int capacity = n / 16 > 0 ? n / 16 : 1;
+    int universe = 4 * capacity;
+
+    printf("\tcapacity %d nodes, the result is the number of hits\n", capacity);
+    for (unsigned int p = 0; p < sizeof(policies) / sizeof(policies[0]); ++p) {
+        BSTreeOptions options;
+        bstree_default_options(&options);
+        options.max_nodes = (size_t)capacity;
+        options.eviction = policies[p].policy;
+        BSTreeHandle* h = bstree_handle_create(&options);
+
+        long long hits = 0;
+        double start = now();
+        for (int i = 0; i < n; ++i) {
+            unsigned int draw = (unsigned int)bench_key(i);
+            int key = (int)(draw % (unsigned int)(draw & 1 ? universe / 8 : universe));
+            if (!bstree_empty(bstree_handle_access(h, key)))
+                ++hits;
+            else
+                bstree_handle_add(h, key);
+        }
+        snprintf(label, sizeof(label), "%d accesses, %s", n, policies[p].name);
+        report(label, now() - start, hits);
+        printf("\t  %zu nodes of %zu bytes, %zu evictions\n", bstree_handle_size(h), bstree_options_node_size(&options),
+               bstree_handle_evictions(h));
+        bstree_handle_delete(&h);
+    }
+}
+
+/*------------------------  Write-ahead log  -----------------------------*/
+
+/* Insertions with the operations logged before being applied, returns the elapsed time */
+static double run_logged(WriteAheadLog* log, int n) {
+    BinarySearchTree* t = bstree_create();
+    double start = now();
+    for (int i = 0; i < n; ++i) {
+        if (log)
+            wal_log_add(log, bench_key(i));
+        bstree_add(&t, bench_key(i));
+    }
+    if (log)
+        wal_sync(log);
+    double seconds = now() - start;
+    bstree_delete(&t);
+    return seconds;
+}
+
+static void bench_wal(int n) {
+    char filename[64];
+    char label[64];
+    snprintf(filename, sizeof(filename), "bstreebench-%d.wal", (int)getpid());
+
+    report("insertions without log", run_logged(NULL, n), n);
+    for (int sync = 0; sync < 2; ++sync) {
+        WalOptions options;
+        wal_default_options(&options);
+        options.sync = sync;
+        WriteAheadLog* log = wal_open(filename, 0, &options);
+        if (!log) {
+            perror(filename);
+            return;
+        }
+        double seconds = run_logged(log, n);
+        snprintf(label, sizeof(label), "insertions with log, %s", sync ? "fdatasync" : "no fdatasync");
+        report(label, seconds, n);
+        printf("\t  %llu groups committed\n", wal_groups(log));
+        wal_close(&log);
+
+        BinarySearchTree* t = bstree_create();
+        WalRecovery recovery = wal_recover(NULL, filename, &t, false);
+        report("  recovery from the log", recovery.seconds, (long long)recovery.replayed);
+        bstree_delete(&t);
+        unlink(filename);
+    }
+}
+
+/*------------------------  Augmented trees  -----------------------------*/
+
+static void sum_node(const BinarySearchTree* t, void* env) {
+    *(long long*)env += bstree_key(t);
+}
+
+/* Range sums with a visit of the range and with the summaries of a tree augmented with the sums of the keys */
+static void bench_aggregate(int n) {
+    static const int queries = 1000;
+    char label[64];
+    BSTreeAugmentation sum;
+    bstree_sum_augmentation(&sum);
+    BSTreeOptions options;
+    bstree_default_options(&options);
+    BSTreeHandle* plain = bstree_handle_create(&options);
+    options.augmentation = &sum;
+    BSTreeHandle* augmented = bstree_handle_create(&options);
+
+    double start = now();
+    for (int i = 0; i < n; ++i)
+        bstree_handle_add(plain, bench_key(i));
+    report("insertions", now() - start, n);
+    start = now();
+    for (int i = 0; i < n; ++i)
+        bstree_handle_add(augmented, bench_key(i));
+    report("insertions with summaries", now() - start, n);
+
+    /* each query covers 1% of the key range, about n / 100 keys */
+    unsigned int width = 0xffffffffu / 100;
+    for (int method = 0; method < 2; ++method) {
+        long long total = 0;
+        start = now();
+        for (int q = 0; q < queries; ++q) {
+            int low = bench_key((unsigned int)(n + q));
+            int high = low > (int)(0x7fffffffu - width) ? 0x7fffffff : low + (int)width;
+            if (method == 0) {
+                bstree_range(bstree_handle_root(plain), low, high, sum_node, &total);
+            }
+            else {
+                BSTreeSum aggregate;
+                bstree_handle_aggregate(augmented, low, high, &aggregate);
+                total += aggregate.sum;
+            }
+        }
+        snprintf(label, sizeof(label), "%d range sums, %s", queries, method == 0 ? "visit" : "summaries");
+        report(label, now() - start, total);
+    }
+    bstree_handle_delete(&plain);
+    bstree_handle_delete(&augmented);
+}
+
+/*------------------------  Tree differences  -----------------------------*/
+
+static void count_difference(const BinarySearchTree* t, void* env) {
+    (void)t;
+    ++*(long long*)env;
+}
+
+/* Differences between two replicas of n keys, one of which received a few updates */
+static void bench_diff(int n) {
+    static const int updates = 100;
+    BSTreeAugmentation hash;
+    bstree_hash_augmentation(&hash);
+    BSTreeOptions options;
+    bstree_default_options(&options);
+    options.augmentation = &hash;
+    BSTreeHandle* a = bstree_handle_create(&options);
+    BSTreeHandle* b = bstree_handle_create(&options);
+    for (int i = 0; i < n; ++i) {
+        bstree_handle_add(a, bench_key(i));
+        bstree_handle_add(b, bench_key(i));
+    }
+    for (int i = 0; i < updates; ++i) {
+        bstree_handle_remove(b, bench_key((unsigned int)i * 7919u % (unsigned int)n));
+        bstree_handle_add(b, bench_key((unsigned int)(n + i)));
+    }
+
+    long long differences = 0;
+    double start = now();
+    bstree_diff(bstree_handle_root(a), bstree_handle_root(b), count_difference, count_difference, &differences);
+    report("merge of the infix walks", now() - start, differences);
+
+    differences = 0;
+    start = now();
+    bstree_handle_diff(a, b, count_difference, count_difference, &differences);
+    report("hashed ranges", now() - start, differences);
+    bstree_handle_delete(&a);
+    bstree_handle_delete(&b);
+}
+
+/*------------------------  Bucket trees  -----------------------------*/
+
+static void count_key(BSTreeKey key, void* env) {
+    (void)key;
+    ++*(long long*)env;
+}
+
+/* Same operations on a red-black tree with one node per key and on a bucket tree */
+static void bench_buckets(int n) {
+    for (int hybrid = 0; hybrid < 2; ++hybrid) {
+        BSTreeHandle* h = NULL;
+        BucketTree* bt = NULL;
+        if (hybrid)
+            bt = buckettree_create();
+        else
+            h = bstree_handle_create(NULL);
+        printf("\t%s\n", hybrid ? "bucket tree" : "red-black tree");
+
+        double start = now();
+        for (int i = 0; i < n; ++i) {
+            if (hybrid)
+                buckettree_add(bt, bench_key(i));
+            else
+                bstree_handle_add(h, bench_key(i));
+        }
+        report("  insertions", now() - start, (long long)(hybrid ? buckettree_buckets(bt) : bstree_handle_size(h)));
+
+        long long found = 0;
+        start = now();
+        for (int i = 0; i < n; ++i) {
+            int v = bench_key((unsigned int)i * 7919u % (unsigned int)n);
+            found += hybrid ? buckettree_contains(bt, v) : !bstree_empty(bstree_handle_search(h, v));
+        }
+        report("  searches", now() - start, found);
+
+        long long count = 0;
+        start = now();
+        if (hybrid)
+            buckettree_visit(bt, count_key, &count);
+        else
+            bstree_depth_infix(bstree_handle_root(h), count_node, &count);
+        report("  in-order visit", now() - start, count);
+
+        start = now();
+        for (int i = 0; i < n; i += 2) {
+            if (hybrid)
+                buckettree_remove(bt, bench_key(i));
+            else
+                bstree_handle_remove(h, bench_key(i));
+        }
+        report("  removals", now() - start, (long long)(hybrid ? buckettree_buckets(bt) : bstree_handle_size(h)));
+        if (hybrid)
+            buckettree_delete(&bt);
+        else
+            bstree_handle_delete(&h);
+    }
+}
+
+/*------------------------  Batched queries  -----------------------------*/
+
+static void count_result(size_t query, const BinarySearchTree* node, void* env) {
+    (void)query;
+    *(long long*)env += !bstree_empty(node);
+}
+
+/* Point queries and range queries of about 8 keys, run one after the other then as batches with more and more
+ * queries in flight. The result is the number of keys found. */
+static void bench_batch(int n) {
+    BinarySearchTree* t = build_tree(n);
+    size_t nb = n < 1000000 ? (size_t)n : 1000000;
+    TreeQuery* queries[2] = { malloc(nb * sizeof(TreeQuery)), malloc(nb * sizeof(TreeQuery)) };
+    /* the keys are spread over the int range, 8 gaps between keys hold about 8 keys */
+    long long width = 8 * ((long long)UINT_MAX / n);
+    for (size_t i = 0; i < nb; ++i) {
+        BSTreeKey low = bench_key((unsigned int)i * 7919u % (unsigned int)n);
+        BSTreeKey high = (long long)low + width > INT_MAX ? INT_MAX : (BSTreeKey)(low + width);
+        TreeQuery point = { query_point, low, low };
+        TreeQuery range = { query_range, low, high };
+        queries[0][i] = point;
+        queries[1][i] = range;
+    }
+    const size_t inflight[] = { 1, 4, 16, 32, 64 };
+    char label[64];
+
+    for (int kind = 0; kind < 2; ++kind) {
+        const char* name = kind == 0 ? "points" : "ranges";
+        long long found = 0;
+        double start = now();
+        for (size_t i = 0; i < nb; ++i) {
+            if (kind == 0)
+                found += !bstree_empty(bstree_search(t, queries[0][i].low));
+            else
+                bstree_range(t, queries[1][i].low, queries[1][i].high, count_node, &found);
+        }
+        snprintf(label, sizeof(label), "%zu %s, one by one", nb, name);
+        report(label, now() - start, found);
+
+        for (size_t k = 0; k < sizeof(inflight) / sizeof(inflight[0]); ++k) {
+            QueryExecutor* e = executor_create(inflight[k]);
+            found = 0;
+            start = now();
+            executor_run(e, t, queries[kind], nb, count_result, &found);
+            snprintf(label, sizeof(label), "%zu %s, %zu in flight", nb, name, inflight[k]);
+            report(label, now() - start, found);
+            executor_delete(&e);
+        }
+    }
+    free(queries[0]);
+    free(queries[1]);
+    bstree_delete(&t);
+}
+
+/*------------------------  Huge pages and NUMA placement  -----------------------------*/
+
+/* Counter of the data TLB misses of the process, -1 if the system does not give access to it */
+static int tlb_counter_open(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void tlb_counter_start(int fd) {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)fd;
+#endif
+}
+
+/* Number of misses since tlb_counter_start, -1 if unknown */
+static long long tlb_counter_stop(int fd) {
+    long long misses = -1;
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+    }
+#else
+    (void)fd;
+#endif
+    return misses;
+}
+
+/* Random searches in trees whose nodes come from malloc and from pools with each kind of pages and placement */
+static void bench_pages(int n) {
+    static const struct {
+        const char* name;
+        bool pool;
+        NodePoolPages pages;
+        NodePoolPlacement placement;
+    } configurations[] = {
+        { "malloc", false, pages_default, placement_default },
+        { "pool, standard pages", true, pages_default, placement_default },
+        { "pool, transparent huge pages", true, pages_transparent, placement_default },
+        { "pool, reserved huge pages", true, pages_huge, placement_default },
+        { "pool, huge pages, local node", true, pages_huge, placement_local },
+        { "pool, huge pages, interleaved", true, pages_huge, placement_interleave },
+    };
+    int counter = tlb_counter_open();
+    if (counter < 0)
+        printf("\tdata TLB misses are not available (perf_event_open), see /proc/sys/kernel/perf_event_paranoid\n");
+
+    for (unsigned int c = 0; c < sizeof(configurations) / sizeof(configurations[0]); ++c) {
+        BSTreeOptions options;
+        bstree_default_options(&options);
+        NodePool* pool = NULL;
+        if (configurations[c].pool) {
+            NodePoolOptions pool_options;
+            nodepool_default_options(&pool_options);
+            pool_options.pages = configurations[c].pages;
+            pool_options.placement = configurations[c].placement;
+            pool = nodepool_create_with_options(&pool_options);
+            options.allocator = nodepool_allocator(pool);
+        }
+        BSTreeHandle* h = bstree_handle_create(&options);
+        for (int i = 0; i < n; ++i)
+            bstree_handle_add(h, bench_key(i));
+
+        long long found = 0;
+        tlb_counter_start(counter);
+        double start = now();
+        for (int i = 0; i < n; ++i)
+            found += !bstree_empty(bstree_handle_search(h, bench_key((unsigned int)i * 7919u % (unsigned int)n)));
+        double seconds = now() - start;
+        long long misses = tlb_counter_stop(counter);
+
+        printf("\t%-40s %10.2f ns/op", configurations[c].name, seconds * 1e9 / n);
+        if (misses >= 0)
+            printf("  %8.3f dTLB misses/op", (double)misses / n);
+        printf("  (result %lld)\n", found);
+        if (pool) {
+            NodePoolStats stats = nodepool_stats(pool);
+            printf("\t  %zu MB of chunks : %zu MB reserved huge pages, %zu MB advised huge, %zu MB placed\n",
+                   stats.bytes >> 20, stats.huge_bytes >> 20, stats.transparent_bytes >> 20, stats.placed_bytes >> 20);
+        }
+        bstree_handle_delete(&h);
+        if (pool)
+            nodepool_delete(&pool);
+    }
+    if (counter >= 0)
+        close(counter);
+}
+
+/*------------------------  Operations  -----------------------------*/
+
+/* Prints the cost of one operation, in nanoseconds */
+static void report_operation(const char* label, double seconds, long long nb, long long result) {
+    printf("\t%-40s %10.2f ns/op  (result %lld)\n", label, seconds * 1e9 / nb, result);
+}
+
+/* Search written with the accessors, the calls are inlined only in the release build */
+static const BinarySearchTree* accessor_search(const BinarySearchTree* t, BSTreeKey v) {
+    while (!bstree_empty(t) && bstree_key(t) != v)
+        t = v < bstree_key(t) ? bstree_left(t) : bstree_right(t);
+    return t;
+}
+
+/* Per operation costs, compared across the build configurations by compare_builds.sh */
+static void bench_operations(int n) {
+    BinarySearchTree* t = bstree_create();
+    double start = now();
+    for (int i = 0; i < n; ++i)
+        bstree_add(&t, bench_key(i));
+    report_operation("add", now() - start, n, n);
+
+    long long found = 0;
+    start = now();
+    for (int i = 0; i < n; ++i)
+        found += !bstree_empty(bstree_search(t, bench_key((unsigned int)i * 7919u % (unsigned int)n)));
+    report_operation("bstree_search", now() - start, n, found);
+
+    found = 0;
+    start = now();
+    for (int i = 0; i < n; ++i)
+        found += !bstree_empty(accessor_search(t, bench_key((unsigned int)i * 7919u % (unsigned int)n)));
+    report_operation("search through the accessors", now() - start, n, found);
+
+    long long count = 0;
+    start = now();
+    bstree_depth_infix(t, count_node, &count);
+    report_operation("visit, OperateFunctor", now() - start, n, count);
+
+    count = 0;
+    start = now();
+    count_infix_inlined(t, &count);
+    report_operation("visit, inlined visitor", now() - start, n, count);
+
+    long long sum = 0;
+    BSTreeIterator* i = bstree_iterator_create(t, forward);
+    start = now();
+    for (bstree_iterator_begin(i); !bstree_iterator_end(i); bstree_iterator_next(i))
+        sum += bstree_key(bstree_iterator_value(i)) & 1;
+    report_operation("iteration", now() - start, n, sum);
+    bstree_iterator_delete(&i);
+
+    start = now();
+    for (int k = 0; k < n; ++k)
+        bstree_remove(&t, bench_key(k));
+    report_operation("remove", now() - start, n, bstree_empty(t));
+    bstree_delete(&t);
+}
+
+/*------------------------  Driver  -----------------------------*/
+
+typedef void (*BenchFunction)(int n);
+
+static const struct {
+    const char* name;
+    BenchFunction run;
+    const char* description;
+} benchmarks[] = {
+    { "visitors", bench_visitors, "function pointer, controlled and inlined visitors" },
+    { "sharded", bench_sharded, "insertion throughput of range sharded trees with concurrent writers" },
+    { "engines", bench_engines, "height, insertion, search and removal costs of the balancing engines" },
+    { "topdown", bench_topdown, "bottom-up and top-down red-black insertions" },
+    { "bounded", bench_bounded, "hit rate and cost of the eviction policies of a bounded tree used as a cache" },
+    { "wal", bench_wal, "cost of the write-ahead log on insertions, and recovery time" },
+    { "aggregate", bench_aggregate, "range sums with a visit and with the summaries of an augmented tree" },
+    { "diff", bench_diff, "differences between two trees, by merge and with hashed ranges" },
+    { "buckets", bench_buckets, "red-black tree against bucket tree, the result of updates is the number of nodes" },
+    { "batch", bench_batch, "point and range queries one by one and interleaved by a QueryExecutor" },
+    { "pages", bench_pages, "search latency and TLB misses with huge pages and NUMA placement of the nodes" },
+    { "operations", bench_operations, "cost of each operation on the tree, in nanoseconds" },
+};
+
+static const int nbBenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+/** Benchmark driver.
+ * usage : bstreebench [benchmark|all [size]]
+ */
+int main(int argc, char** argv) {
+    const char* which = argc > 1 ? argv[1] : "all";
+    int n = argc > 2 ? atoi(argv[2]) : DEFAULT_SIZE;
+    bool ran = false;
+
+    if (n <= 0) {
+        fprintf(stderr, "invalid size %s\n", argv[2]);
+        return 1;
+    }
+    for (int i = 0; i < nbBenchmarks; ++i) {
+        if (strcmp(which, "all") == 0 || strcmp(which, benchmarks[i].name) == 0) {
+            printf("Benchmark %s : %s.\n", benchmarks[i].name, benchmarks[i].description);
+            benchmarks[i].run(n);
+            printf("Done.\n");
+            ran = true;
+        }
+    }
+    if (!ran) {
+        fprintf(stderr, "usage : %s [benchmark|all [size]]\nbenchmarks :", argv[0]);
+        for (int i = 0; i < nbBenchmarks; ++i)
+            fprintf(stderr, " %s", benchmarks[i].name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    return 0;
+}
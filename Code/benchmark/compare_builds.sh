@@ -0,0 +1,42 @@
+#!/bin/sh
+# Builds the benchmark driver with each release configuration and prints the cost of each operation side by side.
+# The last columns are the default release build with 64 bits keys (KEY64=yes) and with the in-order links in the
+# nodes (THREADED=yes).
+# usage : benchmark/compare_builds.sh [size]   (run from the Code directory, default size 100000)
+set -e
+
+SIZE=${1:-100000}
+RESULTS=$(mktemp -d)
+trap 'rm -rf "$RESULTS"' EXIT
+
+run() {
+    name=$1
+    shift
+    make -s clean
+    rm -f ./*.gcda benchmark/*.gcda
+    if [ "$1" = "pgo" ]; then
+        make -s pgo PGO_SIZE="$SIZE"
+    else
+        make -s bstreebench "$@"
+    fi
+    ./bstreebench operations "$SIZE" | awk -F'  +' '/ns\/op/ { sub(/^\t/, "", $1); sub(/ ns\/op.*/, "", $2); print $1 "|" $2 }' > "$RESULTS/$name"
+}
+
+run plain INLINE=no LTO=no
+run inline LTO=no
+run inline+lto
+run pgo pgo
+run key64 KEY64=yes
+run threaded THREADED=yes
+
+printf '%-32s %12s %12s %12s %12s %12s %12s\n' "operation (ns/op)" plain inline inline+lto pgo key64 threaded
+cut -d'|' -f1 "$RESULTS/plain" | while read -r operation; do
+    printf '%-32s' "$operation"
+    for build in plain inline inline+lto pgo key64 threaded; do
+        printf ' %12s' "$(grep -F "$operation|" "$RESULTS/$build" | cut -d'|' -f2)"
+    done
+    printf '\n'
+done
+
+make -s clean
+rm -f ./*.gcda benchmark/*.gcda
@@ -1,21 +1,71 @@
 #include "bstree.h"
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "queue.h"
+#include "bstree_node.h"
 
+#ifdef BSTREE_INLINE_ACCESSORS
+/* External definitions of the inline accessors of bstree_node.h */
+extern inline bool bstree_empty(const BinarySearchTree* t);
+extern inline BSTreeKey bstree_key(const BinarySearchTree* t);
+extern inline BinarySearchTree* bstree_left(const BinarySearchTree* t);
+extern inline BinarySearchTree* bstree_right(const BinarySearchTree* t);
+extern inline BinarySearchTree* bstree_parent(const BinarySearchTree* t);
+extern inline const BinarySearchTree* bstree_successor(const BinarySearchTree* x);
+extern inline const BinarySearchTree* bstree_predecessor(const BinarySearchTree* x);
+#endif
 
-/*------------------------  BSTreeType  -----------------------------*/
-typedef enum {red, black} NodeColor;
+/*------------------------  BSTreeKey  -----------------------------*/
 
-struct _bstree {
-    BinarySearchTree* parent;
-    BinarySearchTree* left;
-    BinarySearchTree* right;
-    NodeColor color;
-    int key;
-};
+/* Unite de la partie haute d'une clé composite */
+#define KEY_HALF ((BSTreeKey)1 << BSTREE_KEY_HALF_BITS)
+
+/* La clé composite est high * KEY_HALF + low avec 0 <= low < KEY_HALF : l'ordre des entiers est l'ordre
+ * lexicographique des couples, la comparaison de deux clés composites reste une seule comparaison.
+ */
+BSTreeKey bstree_key_compose(BSTreeKey high, BSTreeKey low) {
+    assert(high >= -KEY_HALF / 2 && high < KEY_HALF / 2 && low >= 0 && low < KEY_HALF);
+    return high * KEY_HALF + low;
+}
+
+BSTreeKey bstree_key_low(BSTreeKey key) {
+    return (BSTreeKey)((unsigned long long)key & (unsigned long long)(KEY_HALF - 1));
+}
+
+BSTreeKey bstree_key_high(BSTreeKey key) {
+    return (key - bstree_key_low(key)) / KEY_HALF;
+}
+
+const char* bstree_key_parse(const char* text, BSTreeKey* key) {
+    char* end;
+    errno = 0;
+    long long high = strtoll(text, &end, 10);
+    if(end == text || errno == ERANGE){
+        return NULL;
+    }
+    if(*end != ':'){
+        if(high < BSTREE_KEY_MIN || high > BSTREE_KEY_MAX){
+            return NULL;
+        }
+        *key = (BSTreeKey)high;
+        return end;
+    }
+    //Clé composite : la partie basse suit immediatement le ':'
+    const char* low_text = end + 1;
+    if(*low_text < '0' || *low_text > '9'){
+        return NULL;
+    }
+    long long low = strtoll(low_text, &end, 10);
+    if(errno == ERANGE || high < -KEY_HALF / 2 || high >= KEY_HALF / 2 || low >= KEY_HALF){
+        return NULL;
+    }
+    *key = bstree_key_compose((BSTreeKey)high, (BSTreeKey)low);
+    return end;
+}
 
 /*------------------------  BaseBSTree  -----------------------------*/
 
@@ -23,58 +73,133 @@ BinarySearchTree* bstree_create(void) {
     return NULL;
 }
 
+static void* default_allocate(size_t size, void* context) {
+    (void)context;
+    return malloc(size);
+}
+
+static void default_release(void* node, void* context) {
+    (void)context;
+    free(node);
+}
+
+/* Allocator used by the trees that are not managed by a BSTreeHandle */
+static const BSTreeAllocator default_allocator = { default_allocate, default_release, NULL };
+
+size_t bstree_node_size(void) {
+    return sizeof(struct _bstree);
+}
+
+/* Monoide d'un BSTreeHandle augmente, partage par tous ses noeuds. La valeur et le resume de chaque noeud sont
+ * ranges a la suite du noeud, dans la meme allocation.
+ */
+typedef struct _bstree_augmented {
+    BSTreeAugmentation monoid;
+    /* position de la valeur et du resume par rapport au debut du noeud */
+    size_t value_offset;
+    size_t summary_offset;
+    /* taille d'un noeud, valeur et resume compris */
+    size_t node_size;
+    /* resume intermediaire des requetes */
+    void* scratch;
+} Augmented;
+
+/* Alignement des donnees rangees a la suite du noeud, suffisant pour les types de base */
+static size_t suffix_align(size_t size) {
+    size_t a = sizeof(long long) > sizeof(void*) ? sizeof(long long) : sizeof(void*);
+    return (size + a - 1) / a * a;
+}
+
+/* La valeur et le resume suivent les base premiers octets du noeud */
+static void augment_layout(Augmented* a, const BSTreeAugmentation* monoid, size_t base) {
+    a->monoid = *monoid;
+    a->value_offset = suffix_align(base);
+    a->summary_offset = a->value_offset + suffix_align(monoid->value_size);
+    a->node_size = a->summary_offset + monoid->summary_size;
+}
+
+/* Les noeuds ne portent pas le monoide : il est passe par le BSTreeHandle aux moteurs et aux rotations, NULL
+ * pour un arbre sans resumes.
+ */
+static void* augment_value(const Augmented* a, const BinarySearchTree* x) {
+    return (char*)x + a->value_offset;
+}
+
+static void* augment_summary(const Augmented* a, const BinarySearchTree* x) {
+    return (char*)x + a->summary_offset;
+}
+
+/* Calcule dans summary le resume du sous-arbre x a partir des resumes de ses fils */
+static void augment_compute(const Augmented* a, const BinarySearchTree* x, void* summary) {
+    const BSTreeAugmentation* m = &a->monoid;
+    m->lift(summary, x->key, x->count, augment_value(a, x), m->context);
+    if(!bstree_empty(x->left)){
+        m->combine(summary, augment_summary(a, x->left), summary, m->context);
+    }
+    if(!bstree_empty(x->right)){
+        m->combine(summary, summary, augment_summary(a, x->right), m->context);
+    }
+}
+
+/* Met a jour le resume de x, les resumes de ses fils doivent etre a jour */
+static void augment_update(const Augmented* a, BinarySearchTree* x) {
+    augment_compute(a, x, augment_summary(a, x));
+}
+
+/* Met a jour les resumes de x et de tous ses ancetres apres une modification du sous-arbre de x.
+ * Les rotations maintenant les resumes des deux noeuds qu'elles deplacent, les resumes faux pendant une
+ * modification sont toujours ceux des ancetres du noeud ajoute ou retire : un seul passage de ce noeud a la
+ * racine, une fois l'arbre reequilibre, suffit.
+ */
+static void augment_path(const Augmented* a, BinarySearchTree* x) {
+    if(!a){
+        return;
+    }
+    for(; !bstree_empty(x); x = x->parent){
+        augment_update(a, x);
+    }
+}
+
 /* This constructor is private so that we can maintain the oredring invariant on
  * nodes. The only way to add nodes to the tree is with the bstree_add function
  * that ensures the invariant.
  */
-BinarySearchTree* bstree_cons(BinarySearchTree* left, BinarySearchTree* right, int key) {
-    BinarySearchTree* t = malloc(sizeof(struct _bstree));
+BinarySearchTree* bstree_cons(const BSTreeAllocator* allocator, size_t size, Augmented* augmented, BinarySearchTree* left, BinarySearchTree* right, BSTreeKey key) {
+    BinarySearchTree* t = allocator->allocate(size, allocator->context);
     t->parent = NULL;
     t->left = left;
     t->right = right;
     t->color = red;
+    t->rank = 0;
     if (t->left != NULL)
         t->left->parent = t;
     if (t->right != NULL)
         t->right->parent = t;
     t->key = key;
+    t->count = 1;
+#ifdef BSTREE_THREADED
+    t->prev = NULL;
+    t->next = NULL;
+#endif
+    if(augmented){
+        //Valeur nulle a la creation, le resume est celui du noeud seul tant qu'il n'est pas relie a l'arbre
+        memset(augment_value(augmented, t), 0, augmented->monoid.value_size);
+        augment_update(augmented, t);
+    }
     return t;
 }
 
+/* n is the allocator of the node */
 void freenode(const BinarySearchTree* t, void* n) {
-    (void)n;
-    free((BinarySearchTree*)t);
+    const BSTreeAllocator* allocator = n;
+    allocator->release((BinarySearchTree*)t, allocator->context);
 }
 
 void bstree_delete(ptrBinarySearchTree* t) {
-    bstree_depth_postfix(*t, freenode, NULL);
+    bstree_depth_postfix(*t, freenode, (void*)&default_allocator);
     *t=NULL;
 }
 
-bool bstree_empty(const BinarySearchTree* t) {
-    return t == NULL;
-}
-
-int bstree_key(const BinarySearchTree* t) {
-    assert(!bstree_empty(t));
-    return t->key;
-}
-
-BinarySearchTree* bstree_left(const BinarySearchTree* t) {
-    assert(!bstree_empty(t));
-    return t->left;
-}
-
-BinarySearchTree* bstree_right(const BinarySearchTree* t) {
-    assert(!bstree_empty(t));
-    return t->right;
-}
-
-BinarySearchTree* bstree_parent(const BinarySearchTree* t) {
-    assert(!bstree_empty(t));
-    return t->parent;
-}
-
 BinarySearchTree* grandparent(BinarySearchTree* n){
     assert(!bstree_empty(bstree_parent(n)));
     return bstree_parent(bstree_parent(n));
@@ -92,143 +217,316 @@ BinarySearchTree* uncle(BinarySearchTree* n){
     
 }
 
+int bstree_height(const BinarySearchTree* t) {
+    if(bstree_empty(t)){
+        return 0;
+    }
+    int left = bstree_height(bstree_left(t));
+    int right = bstree_height(bstree_right(t));
+    return 1 + (left > right ? left : right);
+}
+
+/*------------------------  BSTreeBalancing  -----------------------------*/
+
+/* Un moteur d'equilibrage retablit l'equilibre de l'arbre apres chaque modification de sa structure.
+ * Les deux operations maintiennent *t sur la racine de l'arbre, et les resumes de a si l'arbre est augmente.
+ */
+typedef struct {
+    /* appelee une fois la nouvelle feuille x reliee a l'arbre */
+    void (*insert_fixup)(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+    /* retire le noeud x de l'arbre, sans le liberer */
+    void (*unlink)(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+    /* si non NULL, remplace la descente commune de bstree_insert, dont elle a la semantique, et insert_fixup */
+    BinarySearchTree* (*insert)(ptrBinarySearchTree* t, BSTreeKey v, const BSTreeAllocator* allocator, size_t size, Augmented* augmented);
+} BalancingEngine;
+
+static void redblack_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void redblack_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void avl_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void avl_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void treap_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void treap_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void llrb_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static void llrb_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+static BinarySearchTree* redblack_topdown_insert(ptrBinarySearchTree* t, BSTreeKey v, const BSTreeAllocator* allocator, size_t size, Augmented* augmented);
+
+/* Les moteurs, indexes par BalancingPolicy */
+static const BalancingEngine engines[] = {
+    [balancing_redblack] = { redblack_insert, redblack_unlink, NULL },
+    [balancing_avl] = { avl_insert, avl_unlink, NULL },
+    [balancing_treap] = { treap_insert, treap_unlink, NULL },
+    [balancing_llrb] = { llrb_insert, llrb_unlink, NULL },
+    [balancing_redblack_topdown] = { NULL, redblack_unlink, redblack_topdown_insert },
+};
+
+/* Insere la nouvelle feuille x dans la liste des noeuds en ordre infixe, maintenue avec BSTREE_THREADED : son
+ * parent est son successeur si x est un fils gauche, son predecesseur sinon. Les rotations ne changeant pas l'ordre
+ * infixe, la liste n'est mise a jour qu'a la creation et a la suppression des noeuds.
+ */
+static void thread_leaf(BinarySearchTree* x) {
+#ifdef BSTREE_THREADED
+    BinarySearchTree* parent = x->parent;
+    if(bstree_empty(parent)){
+        return;
+    }
+    if(parent->left == x){
+        x->next = parent;
+        x->prev = parent->prev;
+    }
+    else{
+        x->prev = parent;
+        x->next = parent->next;
+    }
+    if(!bstree_empty(x->prev)){
+        x->prev->next = x;
+    }
+    if(!bstree_empty(x->next)){
+        x->next->prev = x;
+    }
+#else
+    (void)x;
+#endif
+}
+
+/* Retire x de la liste des noeuds en ordre infixe */
+static void unthread(BinarySearchTree* x) {
+#ifdef BSTREE_THREADED
+    if(!bstree_empty(x->prev)){
+        x->prev->next = x->next;
+    }
+    if(!bstree_empty(x->next)){
+        x->next->prev = x->prev;
+    }
+#else
+    (void)x;
+#endif
+}
+
+/* Moteur des arbres qui ne sont pas geres par un BSTreeHandle */
+static const BalancingEngine* const default_engine = &engines[balancing_redblack];
+
 /*------------------------  BSTreeDictionary  -----------------------------*/
 
-/* Obligation de passer l'arbre par référence pour pouvoir le modifier */
-void bstree_add(ptrBinarySearchTree* t, int v) {
+/* Ajoute v a l'arbre s'il n'y est pas, dans un noeud de size octets.
+ * Retourne le noeud portant déja la clé v, ou NULL si un nouveau noeud a été créé.
+ */
+static BinarySearchTree* bstree_insert(ptrBinarySearchTree* t, BSTreeKey v, const BSTreeAllocator* allocator, size_t size, Augmented* augmented, const BalancingEngine* engine) {
+    if(engine->insert){
+        return engine->insert(t, v, allocator, size, augmented);
+    }
+
     //Définition d'un curseur sur t
     ptrBinarySearchTree cursor = *t;
     ptrBinarySearchTree parent = NULL;
 
-    //On traite dans un premier temps le cas ou l'arbre est vide
-    if(bstree_empty(cursor)){
-        *t = bstree_cons(NULL,NULL,v);
-        return;
-    }
-    
     //Parcours de l'arbre jusqu'à ce que cursor pointe sur une feuille et parent sur le parent du noeud à ajouter
     while(!bstree_empty(cursor)){
         
-        int cursor_key = bstree_key(cursor);
+        BSTreeKey cursor_key = bstree_key(cursor);
         parent = cursor;
 
         //Si la clé est déja dans l'arbre la fonction se stop
         if(cursor_key == v){
-            return;
-        }
-
-        //Si v < cursor_key alors le nouveau cursor va pointer sur le fils gauche de l'actuel 
-        if(v < cursor_key){
-            cursor = bstree_left(cursor);
+            return cursor;
         }
 
-        //Si v > cursor_key alors le nouveau cursor va pointer sur le fils droit de l'actuel 
-        if(v > cursor_key){
-            cursor = bstree_right(cursor);
-        }    
-
+        //Une seule comparaison des clés entières suffit aux deux tests. La direction reste un branchement : une
+        //selection sans branchement attendrait la lecture du noeud alors que la prediction charge deja le fils
+        cursor = v < cursor_key ? bstree_left(cursor) : bstree_right(cursor);
     }
 
     //Creation du nouveau noeud
-    ptrBinarySearchTree newNode = bstree_cons(NULL,NULL,v);
+    ptrBinarySearchTree newNode = bstree_cons(allocator,size,augmented,NULL,NULL,v);
 
-    //Mise a jour de pointeurs
+    //Mise a jour de pointeurs, le cas de l'arbre vide est traite par parent vide
     newNode->parent = parent;
-    if(v > bstree_key(parent)){
+    if(bstree_empty(parent)){
+        *t = newNode;
+    }
+    else if(v > bstree_key(parent)){
         parent->right = newNode;
     }
     else{
         parent->left = newNode;
     }
-    fixredblack_insert(newNode);
+    thread_leaf(newNode);
+    engine->insert_fixup(t, newNode, augmented);
+    augment_path(augmented, newNode);
+    return NULL;
+}
+
+/* Obligation de passer l'arbre par référence pour pouvoir le modifier */
+void bstree_add(ptrBinarySearchTree* t, BSTreeKey v) {
+    bstree_insert(t, v, &default_allocator, sizeof(struct _bstree), NULL, default_engine);
+}
+
+unsigned int bstree_multiset_add(ptrBinarySearchTree* t, BSTreeKey v) {
+    BinarySearchTree* existing = bstree_insert(t, v, &default_allocator, sizeof(struct _bstree), NULL, default_engine);
+    if(bstree_empty(existing)){
+        return 1;
+    }
+    return ++existing->count;
+}
+
+unsigned int bstree_multiset_add_occurrences(ptrBinarySearchTree* t, BSTreeKey v, unsigned int n) {
+    assert(n > 0);
+    BinarySearchTree* existing = bstree_insert(t, v, &default_allocator, sizeof(struct _bstree), NULL, default_engine);
+    if(bstree_empty(existing)){
+        if(n == 1){
+            return 1;
+        }
+        existing = (BinarySearchTree*)bstree_search(*t, v);
+        --n;
+    }
+    existing->count += n;
+    return existing->count;
 }
 
-const BinarySearchTree* bstree_search(const BinarySearchTree* t, int v) {
+const BinarySearchTree* bstree_search(const BinarySearchTree* t, BSTreeKey v) {
 
     const BinarySearchTree* cursor = t;
+    //Meme descente que bstree_insert
     while(!bstree_empty(cursor) && bstree_key(cursor) != v ){
-        int cursor_key = bstree_key(cursor);
-        if(cursor_key > v){
-            cursor = bstree_left(cursor);
-        }
-        if(cursor_key < v){
-            cursor = bstree_right(cursor);
-        }
-
+        cursor = v < bstree_key(cursor) ? bstree_left(cursor) : bstree_right(cursor);
     }
     return cursor;
 }
 
-const BinarySearchTree* bstree_successor(const BinarySearchTree* x) {
-    assert(!bstree_empty(x));
-    const BinarySearchTree* cursor = x;
+unsigned int bstree_count(const BinarySearchTree* t, BSTreeKey v) {
+    const BinarySearchTree* node = bstree_search(t, v);
+    return bstree_empty(node) ? 0 : node->count;
+}
 
-    //Cas ou l'arbre a un fils droit
-    if(!bstree_empty(bstree_right(cursor))){
-        cursor = bstree_right(cursor);
-        while(!bstree_empty(bstree_left(cursor))){
-            cursor = bstree_left(cursor);
-        }
+unsigned int bstree_multiplicity(const BinarySearchTree* t) {
+    assert(!bstree_empty(t));
+    return t->count;
+}
+
+/* Remplace old par new dans les fils de parent, ou a la racine de l'arbre si parent est vide */
+static void replace_child(ptrBinarySearchTree* tree, BinarySearchTree* parent, BinarySearchTree* old, BinarySearchTree* new) {
+    if(bstree_empty(parent)){
+        *tree = new;
+    }
+    else if(parent->left == old){
+        parent->left = new;
     }
-    //Cas ou l'arbre n'a pas de fils droit
     else{
-        int cursor_key = bstree_key(cursor);
-        int x_key = cursor_key;
-        //On remonte jusqu'a trouver une clé supérieur a celle de x
-        while(cursor_key <= x_key){
-            cursor = bstree_parent(cursor);
-            /*Si cursor est NULL alors il n'existe pas de sucesseur de x dans l'arbre on return une NULL*/
-            if(bstree_empty(cursor)){
-                return cursor;
-            }
-            cursor_key = bstree_key(cursor);
-        }
+        parent->right = new;
+    }
+}
 
+/* Echange la place de deux noeuds dans l'arbre, couleurs comprises, sans toucher a leurs clés : les pointeurs
+ * que l'utilisateur détient sur les noeuds restent valides.
+ * @pre to est le minimum du sous-arbre droit de from.
+ */
+void bstree_swap_nodes(ptrBinarySearchTree* tree, ptrBinarySearchTree from, ptrBinarySearchTree to) {
+    assert(!bstree_empty(*tree) && !bstree_empty(from) && !bstree_empty(to));
+    assert(!bstree_empty(from->left) && bstree_empty(to->left));
+    BinarySearchTree* from_parent = from->parent;
+    BinarySearchTree* from_left = from->left;
+    BinarySearchTree* to_parent = to->parent;
+    BinarySearchTree* to_right = to->right;
+
+    //to prend la place de from
+    replace_child(tree, from_parent, from, to);
+    to->parent = from_parent;
+    to->left = from_left;
+    from_left->parent = to;
+    if(from->right == to){
+        //Cas ou to est directement le fils droit de from
+        to->right = from;
+        from->parent = to;
     }
-    return cursor;
+    else{
+        to->right = from->right;
+        to->right->parent = to;
+        to_parent->left = from;
+        from->parent = to_parent;
+    }
+    //from prend la place de to
+    from->left = NULL;
+    from->right = to_right;
+    if(!bstree_empty(to_right)){
+        to_right->parent = from;
+    }
+
+    //Les informations d'equilibrage suivent la position dans l'arbre
+    NodeColor color = from->color;
+    from->color = to->color;
+    to->color = color;
+    int rank = from->rank;
+    from->rank = to->rank;
+    to->rank = rank;
 }
 
-const BinarySearchTree* bstree_predecessor(const BinarySearchTree* x) {
-    assert(!bstree_empty(x));
-    const BinarySearchTree* cursor = x;
-    //Cas ou l'arbre a un fils gauche
-    if(!bstree_empty(bstree_left(x))){
-        cursor = bstree_left(cursor);
-        while(!bstree_empty(bstree_right(cursor))){
-            cursor = bstree_right(cursor);
-        }
+void fixredblack_remove(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a);
+
+/* Noeud qui succede a x dans un arbre ou x a deux fils */
+static BinarySearchTree* right_min(BinarySearchTree* x) {
+    BinarySearchTree* successor = x->right;
+    while(!bstree_empty(successor->left)){
+        successor = successor->left;
     }
+    return successor;
+}
 
-    //Cas ou l'arbre n'a pas de fils gauche
-    else{
-        int cursor_key = bstree_key(cursor);
-        int x_key = cursor_key;
-        //On remonte jusqu'a trouver une clé inférieure a celle de x
-        while(cursor_key >= x_key){
-            cursor = bstree_parent(cursor);
-            /*Si cursor est NULL alors il n'existe pas de predecesseur de x dans l'arbre on return une NULL*/
-            if(bstree_empty(cursor)){
-                return cursor;
-            }
-            cursor_key = bstree_key(cursor);
-        }
+/* Retire le noeud x, qui a au plus un fils, en le remplacant par ce fils. Retourne le fils. */
+static BinarySearchTree* splice_node(ptrBinarySearchTree* t, BinarySearchTree* x) {
+    BinarySearchTree* child = bstree_empty(x->left) ? x->right : x->left;
+    replace_child(t, x->parent, x, child);
+    if(!bstree_empty(child)){
+        child->parent = x->parent;
     }
-    return cursor;
+    return child;
 }
 
-void bstree_swap_nodes(ptrBinarySearchTree* tree, ptrBinarySearchTree from, ptrBinarySearchTree to) {
-    assert(!bstree_empty(*tree) && !bstree_empty(from) && !bstree_empty(to));
-    (void)tree; (void)from; (void)to;
+/* Retire le noeud current d'un arbre rouge-noir sans le liberer */
+static void redblack_unlink(ptrBinarySearchTree* t, ptrBinarySearchTree current, const Augmented* a) {
+    assert(!bstree_empty(*t) && !bstree_empty(current));
+    //Noeud a deux fils : on l'echange avec son successeur, il a alors au plus un fils
+    if(!bstree_empty(current->left) && !bstree_empty(current->right)){
+        bstree_swap_nodes(t, current, right_min(current));
+    }
+
+    BinarySearchTree* child = bstree_empty(current->left) ? current->right : current->left;
+    if(current->color == black){
+        if(!bstree_empty(child)){
+            //Un noeud noir avec un seul fils a forcement un fils rouge : il prend sa couleur
+            child->color = black;
+        }
+        else{
+            //Noeud noir sans fils : on retablit l'invariant avant de le retirer
+            fixredblack_remove(t, current, a);
+        }
+    }
+    splice_node(t, current);
+    augment_path(a, current->parent);
 }
 
 // t -> the tree to remove from, current -> the node to remove
 void bstree_remove_node(ptrBinarySearchTree* t, ptrBinarySearchTree current) {
-    assert(!bstree_empty(*t) && !bstree_empty(current));
-    (void)t; (void)current;
+    unthread(current);
+    default_engine->unlink(t, current, NULL);
+    freenode(current, (void*)&default_allocator);
 }
 
-void bstree_remove(ptrBinarySearchTree* t, int v) {
-    (void)t; (void)v;
+void bstree_remove(ptrBinarySearchTree* t, BSTreeKey v) {
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(*t, v);
+    if(!bstree_empty(node)){
+        bstree_remove_node(t, node);
+    }
+}
+
+void bstree_multiset_remove(ptrBinarySearchTree* t, BSTreeKey v) {
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(*t, v);
+    if(!bstree_empty(node)){
+        if(node->count > 1){
+            --node->count;
+        }
+        else{
+            bstree_remove_node(t, node);
+        }
+    }
 }
 
 /*------------------------  BSTreeVisitors  -----------------------------*/
@@ -257,51 +555,260 @@ void bstree_depth_postfix(const BinarySearchTree* t, OperateFunctor f, void* env
     }
 }
 
-void bstree_iterative_breadth(const BinarySearchTree* t, OperateFunctor f, void* environment) {
-    Queue* q = create_queue();
+/* Memoire des parcours iteratifs : un seul tableau de noeuds, utilise comme file circulaire par les parcours en
+ * largeur et comme pile par le parcours infixe. Sa taille est une puissance de 2 qui double quand il est plein :
+ * aucune allocation par noeud, O(log largeur) allocations pour un parcours, et aucune une fois le tableau assez
+ * grand quand il est reutilise.
+ */
+struct _BSTreeTraversal {
+    const BinarySearchTree** nodes;
+    size_t capacity;
+    /* debut de la file, toujours 0 pour la pile */
+    size_t head;
+    size_t size;
+};
+
+/* Capacite minimale, suffisante pour les 7 premiers niveaux d'un arbre equilibre */
+#define TRAVERSAL_CAPACITY 64
+
+static void traversal_reserve(BSTreeTraversal* c, size_t capacity) {
+    size_t old = c->capacity;
+    if(capacity <= old){
+        return;
+    }
+    size_t size = old ? old : TRAVERSAL_CAPACITY;
+    while(size < capacity){
+        size *= 2;
+    }
+    c->nodes = realloc(c->nodes, size * sizeof(*c->nodes));
+    //La partie [0, head) de la file est recopiee apres l'ancienne fin pour rester contigue
+    memcpy(c->nodes + old, c->nodes, c->head * sizeof(*c->nodes));
+    c->capacity = size;
+}
+
+static void ring_push(BSTreeTraversal* c, const BinarySearchTree* x) {
+    if(c->size == c->capacity){
+        traversal_reserve(c, c->capacity + 1);
+    }
+    c->nodes[(c->head + c->size) & (c->capacity - 1)] = x;
+    ++c->size;
+}
+
+static const BinarySearchTree* ring_pop(BSTreeTraversal* c) {
+    const BinarySearchTree* x = c->nodes[c->head];
+    c->head = (c->head + 1) & (c->capacity - 1);
+    --c->size;
+    return x;
+}
+
+/* La pile est la file dont le debut reste en 0 */
+static const BinarySearchTree* stack_pop(BSTreeTraversal* c) {
+    return c->nodes[--c->size];
+}
+
+BSTreeTraversal* bstree_traversal_create(size_t capacity) {
+    BSTreeTraversal* c = malloc(sizeof(BSTreeTraversal));
+    c->nodes = NULL;
+    c->capacity = 0;
+    c->head = 0;
+    c->size = 0;
+    traversal_reserve(c, capacity);
+    return c;
+}
+
+void bstree_traversal_delete(ptrBSTreeTraversal* c) {
+    free((*c)->nodes);
+    free(*c);
+    *c = NULL;
+}
+
+size_t bstree_traversal_capacity(const BSTreeTraversal* c) {
+    return c->capacity;
+}
+
+void bstree_traversal_breadth(BSTreeTraversal* c, const BinarySearchTree* t, OperateFunctor f, LevelFunctor level, void* environment) {
+    c->head = 0;
+    c->size = 0;
     if(!bstree_empty(t)){
-        queue_push(q,t);
+        ring_push(c, t);
     }
-    while(!queue_empty(q)){
-        const BinarySearchTree* elementATraiter = queue_top(q);
-        BinarySearchTree* left = bstree_left(elementATraiter);
-        BinarySearchTree* right = bstree_right(elementATraiter);
-        queue_pop(q);
-        
-        f(elementATraiter,environment);
+    //La file contient exactement un niveau au debut de chaque tour
+    for(int depth = 0; c->size; ++depth){
+        size_t width = c->size;
+        for(size_t i = 0; i < width; ++i){
+            const BinarySearchTree* x = ring_pop(c);
+            if(!bstree_empty(x->left)){
+                ring_push(c, x->left);
+            }
+            if(!bstree_empty(x->right)){
+                ring_push(c, x->right);
+            }
+            if(f){
+                f(x, environment);
+            }
+        }
+        if(level){
+            level(depth, width, environment);
+        }
+    }
+}
 
-        if(!bstree_empty(left)){
-            queue_push(q,left);
+bool bstree_traversal_breadth_until(BSTreeTraversal* c, const BinarySearchTree* t, ControlFunctor f, void* environment) {
+    c->head = 0;
+    c->size = 0;
+    if(!bstree_empty(t)){
+        ring_push(c, t);
+    }
+    while(c->size){
+        const BinarySearchTree* elementATraiter = ring_pop(c);
+        VisitAction action = f(elementATraiter,environment);
+        if(action == visit_stop){
+            return true;
         }
-        if(!bstree_empty(right)){
-            queue_push(q,right);
+        if(action == visit_continue){
+            if(!bstree_empty(elementATraiter->left)){
+                ring_push(c, elementATraiter->left);
+            }
+            if(!bstree_empty(elementATraiter->right)){
+                ring_push(c, elementATraiter->right);
+            }
         }
     }
+    return false;
 }
 
-void bstree_iterative_depth_infix(const BinarySearchTree* t, OperateFunctor f, void* environment) {
-    Queue* noeudsATraiter = create_queue();
+void bstree_traversal_depth_infix(BSTreeTraversal* c, const BinarySearchTree* t, OperateFunctor f, void* environment) {
+    c->head = 0;
+    c->size = 0;
     const BinarySearchTree* cursor = t;
-
-    while(!queue_empty(noeudsATraiter) || !bstree_empty(cursor)){
+    //La pile contient les ancetres de cursor dont le sous-arbre gauche est en cours de visite
+    while(c->size || !bstree_empty(cursor)){
         while(!bstree_empty(cursor)){
-            queue_push(noeudsATraiter,cursor);
-            cursor = bstree_left(cursor);
+            ring_push(c, cursor);
+            cursor = cursor->left;
+        }
+        cursor = stack_pop(c);
+        f(cursor,environment);
+        cursor = cursor->right;
+    }
+}
+
+void bstree_breadth_levels(const BinarySearchTree* t, OperateFunctor f, LevelFunctor level, void* environment) {
+    BSTreeTraversal c = { NULL, 0, 0, 0 };
+    bstree_traversal_breadth(&c, t, f, level, environment);
+    free(c.nodes);
+}
+
+void bstree_iterative_breadth(const BinarySearchTree* t, OperateFunctor f, void* environment) {
+    bstree_breadth_levels(t, f, NULL, environment);
+}
+
+void bstree_iterative_depth_infix(const BinarySearchTree* t, OperateFunctor f, void* environment) {
+    BSTreeTraversal c = { NULL, 0, 0, 0 };
+    bstree_traversal_depth_infix(&c, t, f, environment);
+    free(c.nodes);
+}
+
+bool bstree_depth_prefix_until(const BinarySearchTree* t, ControlFunctor f, void* environment) {
+    if(bstree_empty(t)){
+        return false;
+    }
+    VisitAction action = f(t,environment);
+    if(action != visit_continue){
+        return action == visit_stop;
+    }
+    return bstree_depth_prefix_until(bstree_left(t),f,environment)
+        || bstree_depth_prefix_until(bstree_right(t),f,environment);
+}
+
+bool bstree_depth_infix_until(const BinarySearchTree* t, ControlFunctor f, void* environment) {
+    //Le fils droit est traite iterativement pour limiter la profondeur de recursion
+    while(!bstree_empty(t)){
+        if(bstree_depth_infix_until(bstree_left(t),f,environment)){
+            return true;
+        }
+        VisitAction action = f(t,environment);
+        if(action != visit_continue){
+            return action == visit_stop;
+        }
+        t = bstree_right(t);
+    }
+    return false;
+}
+
+bool bstree_iterative_breadth_until(const BinarySearchTree* t, ControlFunctor f, void* environment) {
+    BSTreeTraversal c = { NULL, 0, 0, 0 };
+    bool stopped = bstree_traversal_breadth_until(&c, t, f, environment);
+    free(c.nodes);
+    return stopped;
+}
+
+void bstree_range(const BinarySearchTree* t, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment) {
+    //Seuls les sous-arbres pouvant contenir des clés de [low, high] sont parcourus
+    while(!bstree_empty(t)){
+        BSTreeKey key = bstree_key(t);
+        if(key < low){
+            t = bstree_right(t);
+        }
+        else if(key > high){
+            t = bstree_left(t);
+        }
+        else{
+            bstree_range(bstree_left(t),low,high,f,environment);
+            f(t,environment);
+            t = bstree_right(t);
         }
+    }
+}
 
-        if(bstree_empty(cursor) && !queue_empty(noeudsATraiter)){
-            cursor = queue_top(noeudsATraiter);
-            queue_pop(noeudsATraiter);
-            f(cursor,environment);
+/* Premier noeud de clé au moins v, NULL s'il n'y en a pas */
+static const BinarySearchTree* lower_bound(const BinarySearchTree* t, BSTreeKey v) {
+    const BinarySearchTree* found = NULL;
+    while(!bstree_empty(t)){
+        if(t->key < v){
+            t = t->right;
+        }
+        else{
+            found = t;
+            t = t->left;
         }
-        cursor = bstree_right(cursor);
+    }
+    return found;
+}
 
-    } 
-    
+/* Fusion des suites infixes commencant en x et en y, limitees aux clés au plus high */
+static void diff_merge(const BinarySearchTree* x, const BinarySearchTree* y, BSTreeKey high, OperateFunctor on_added, OperateFunctor on_removed, void* environment) {
+    x = !bstree_empty(x) && x->key <= high ? x : NULL;
+    y = !bstree_empty(y) && y->key <= high ? y : NULL;
+    while(!bstree_empty(x) || !bstree_empty(y)){
+        //Une cle commune n'avance les deux suites que si elle a le meme nombre d'occurrences
+        if(bstree_empty(y) || (!bstree_empty(x) && x->key < y->key)){
+            on_removed(x, environment);
+            x = bstree_successor(x);
+        }
+        else if(bstree_empty(x) || y->key < x->key){
+            on_added(y, environment);
+            y = bstree_successor(y);
+        }
+        else{
+            if(x->count != y->count){
+                on_removed(x, environment);
+                on_added(y, environment);
+            }
+            x = bstree_successor(x);
+            y = bstree_successor(y);
+        }
+        x = !bstree_empty(x) && x->key <= high ? x : NULL;
+        y = !bstree_empty(y) && y->key <= high ? y : NULL;
+    }
+}
+
+void bstree_diff(const BinarySearchTree* a, const BinarySearchTree* b, OperateFunctor on_added, OperateFunctor on_removed, void* environment) {
+    diff_merge(lower_bound(a, BSTREE_KEY_MIN), lower_bound(b, BSTREE_KEY_MIN), BSTREE_KEY_MAX, on_added, on_removed, environment);
 }
 
-void leftrotate(BinarySearchTree *x){
-    assert(!bstree_empty(bstree_parent(x)));
+void leftrotate(BinarySearchTree *x, const Augmented* a){
+    assert(!bstree_empty(x));
     BinarySearchTree* y = bstree_right(x) ;
     assert(!bstree_empty(y));
     BinarySearchTree* b = bstree_left(y);
@@ -315,7 +822,9 @@ void leftrotate(BinarySearchTree *x){
     //Le fils droit de x est b
     x->right = b;
     //Le parent de b est x
-    b->parent = x;
+    if(!bstree_empty(b)){
+        b->parent = x;
+    }
     
     /*Parents de y*/
     if(!bstree_empty(y->parent)){
@@ -327,11 +836,14 @@ void leftrotate(BinarySearchTree *x){
         }
     }
     
-    
-    
+    /*Resumes : x est maintenant sous y*/
+    if(a){
+        augment_update(a, x);
+        augment_update(a, y);
+    }
 }
 
-void rightrotate(BinarySearchTree *y){
+void rightrotate(BinarySearchTree *y, const Augmented* a){
     assert(!bstree_empty(y));
     BinarySearchTree* x = bstree_left(y);
     assert(!bstree_empty(x));
@@ -344,7 +856,9 @@ void rightrotate(BinarySearchTree *y){
     y->parent = x;
     y->left = b;
     /*b*/
-    b->parent = y;
+    if(!bstree_empty(b)){
+        b->parent = y;
+    }
     
     /*Parents de x*/
     if(!bstree_empty(x->parent)){
@@ -355,44 +869,626 @@ void rightrotate(BinarySearchTree *y){
             x->parent->right = x;
         }
     }
+
+    /*Resumes : y est maintenant sous x*/
+    if(a){
+        augment_update(a, y);
+        augment_update(a, x);
+    }
 }
 
 void testrotateleft(BinarySearchTree* t){
-    leftrotate(t);
+    leftrotate(t, NULL);
 }
 void testrotateright( BinarySearchTree* t){
-    rightrotate(t) ;
+    rightrotate(t, NULL) ;
 }
 
-/*------------------------  BSTreeIterator  -----------------------------*/
-
-struct _BSTreeIterator {
-    /* the collection the iterator is attached to */
-    const BinarySearchTree* collection;
-    /* the first element according to the iterator direction */
-    const BinarySearchTree* (*begin)(const BinarySearchTree* );
-    /* the current element pointed by the iterator */
-    const BinarySearchTree* current;
-    /* function that goes to the next element according to the iterator direction */
-    const BinarySearchTree* (*next)(const BinarySearchTree* );
+/*------------------------  BSTreeHandle  -----------------------------*/
+
+struct _bstree_handle {
+    /* the root of the managed tree */
+    BinarySearchTree* root;
+    /* the options given at the creation of the tree */
+    BSTreeOptions options;
+    /* number of nodes of the tree */
+    size_t size;
+    /* maximum number of nodes derived from max_nodes and max_bytes, 0 if the tree is not bounded */
+    size_t capacity;
+    /* size of the nodes, with the recency links, the value and the summary stored after them */
+    size_t node_size;
+    /* ends of the recency list, maintained only when the eviction policy uses it */
+    BinarySearchTree* oldest;
+    BinarySearchTree* newest;
+    /* number of nodes evicted since the creation */
+    size_t evictions;
+    /* monoid of the summaries, NULL if the tree is not augmented */
+    Augmented* augmented;
 };
 
-/* minimum element of the collection */
-const BinarySearchTree* goto_min(const BinarySearchTree* e) {
-	(void)e;
-	return NULL;
+void bstree_default_options(BSTreeOptions* options) {
+    options->allocator = default_allocator;
+    options->multiset = false;
+    options->balancing = balancing_redblack;
+    options->max_nodes = 0;
+    options->max_bytes = 0;
+    options->eviction = eviction_oldest;
+    options->augmentation = NULL;
 }
 
-/* maximum element of the collection */
-const BinarySearchTree* goto_max(const BinarySearchTree* e) {
-	(void)e;
-	return NULL;
+/* La liste de recence n'est utile que pour les politiques qui evincent selon l'age des noeuds */
+static bool uses_recency(const BSTreeOptions* options) {
+    return (options->max_nodes || options->max_bytes) && options->eviction != eviction_smallest;
 }
 
-/* constructor */
+/* Liens de la liste de recence, ranges a la suite du noeud quand la politique d'eviction les utilise : les autres
+ * arbres n'en paient pas la place.
+ */
+typedef struct {
+    BinarySearchTree* older;
+    BinarySearchTree* newer;
+} Recency;
+
+static Recency* recency(const BinarySearchTree* x) {
+    return (Recency*)((char*)x + suffix_align(sizeof(struct _bstree)));
+}
+
+/* Taille des noeuds d'un arbre gere : le noeud, puis ses liens de recence, puis sa valeur et son resume.
+ * Remplit a si l'arbre est augmente.
+ */
+static size_t node_layout(const BSTreeOptions* options, Augmented* a) {
+    size_t size = sizeof(struct _bstree);
+    if(uses_recency(options)){
+        size = suffix_align(size) + sizeof(Recency);
+    }
+    if(options->augmentation){
+        augment_layout(a, options->augmentation, size);
+        size = a->node_size;
+    }
+    return size;
+}
+
+size_t bstree_options_node_size(const BSTreeOptions* options) {
+    Augmented a;
+    return node_layout(options, &a);
+}
+
+BSTreeHandle* bstree_handle_create(const BSTreeOptions* options) {
+    BSTreeHandle* h = malloc(sizeof(struct _bstree_handle));
+    h->root = bstree_create();
+    if(options){
+        h->options = *options;
+    }
+    else{
+        bstree_default_options(&h->options);
+    }
+    h->size = 0;
+    h->augmented = h->options.augmentation ? malloc(sizeof(Augmented)) : NULL;
+    h->node_size = node_layout(&h->options, h->augmented);
+    if(h->augmented){
+        h->augmented->scratch = malloc(h->augmented->monoid.summary_size);
+        h->options.augmentation = &h->augmented->monoid;
+    }
+    h->capacity = h->options.max_nodes;
+    if(h->options.max_bytes){
+        size_t nodes = h->options.max_bytes / h->node_size;
+        //Un budget inferieur a la taille d'un noeud garde tout de meme un noeud
+        nodes = nodes ? nodes : 1;
+        if(!h->capacity || nodes < h->capacity){
+            h->capacity = nodes;
+        }
+    }
+    h->oldest = NULL;
+    h->newest = NULL;
+    h->evictions = 0;
+    return h;
+}
+
+static bool tracks_recency(const BSTreeHandle* h) {
+    return uses_recency(&h->options);
+}
+
+/* Ajoute le noeud x en queue de la liste de recence, comme noeud le plus recent */
+static void recency_append(BSTreeHandle* h, BinarySearchTree* x) {
+    Recency* r = recency(x);
+    r->older = h->newest;
+    r->newer = NULL;
+    if(bstree_empty(h->newest)){
+        h->oldest = x;
+    }
+    else{
+        recency(h->newest)->newer = x;
+    }
+    h->newest = x;
+}
+
+/* Retire le noeud x de la liste de recence */
+static void recency_unlink(BSTreeHandle* h, BinarySearchTree* x) {
+    Recency* r = recency(x);
+    if(bstree_empty(r->older)){
+        h->oldest = r->newer;
+    }
+    else{
+        recency(r->older)->newer = r->newer;
+    }
+    if(bstree_empty(r->newer)){
+        h->newest = r->older;
+    }
+    else{
+        recency(r->newer)->older = r->older;
+    }
+    r->older = NULL;
+    r->newer = NULL;
+}
+
+/* Marque le noeud x comme utilise, seule la politique LRU deplace le noeud dans la liste */
+static void recency_touch(BSTreeHandle* h, BinarySearchTree* x) {
+    if(tracks_recency(h) && h->options.eviction == eviction_lru && h->newest != x){
+        recency_unlink(h, x);
+        recency_append(h, x);
+    }
+}
+
+/* Retire le noeud x de l'arbre gere et le libere */
+static void handle_remove_node(BSTreeHandle* h, BinarySearchTree* x) {
+    if(tracks_recency(h)){
+        recency_unlink(h, x);
+    }
+    unthread(x);
+    engines[h->options.balancing].unlink(&h->root, x, h->augmented);
+    freenode(x, &h->options.allocator);
+    --h->size;
+}
+
+/* Enregistre un noeud qui vient d'etre cree pour la cle v puis evince si la capacite est depassee.
+ * Retourne false si le nouveau noeud a lui-meme ete evince.
+ */
+static bool handle_created(BSTreeHandle* h, BSTreeKey v) {
+    ++h->size;
+    if(!h->capacity){
+        return true;
+    }
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(h->root, v);
+    if(tracks_recency(h)){
+        recency_append(h, node);
+    }
+    bool kept = true;
+    while(h->size > h->capacity){
+        BinarySearchTree* victim = h->oldest;
+        if(h->options.eviction == eviction_smallest){
+            victim = h->root;
+            while(!bstree_empty(victim->left)){
+                victim = victim->left;
+            }
+        }
+        kept = kept && victim != node;
+        handle_remove_node(h, victim);
+        ++h->evictions;
+    }
+    return kept;
+}
+
+void bstree_handle_delete(ptrBSTreeHandle* h) {
+    bstree_depth_postfix((*h)->root, freenode, &(*h)->options.allocator);
+    if((*h)->augmented){
+        free((*h)->augmented->scratch);
+        free((*h)->augmented);
+    }
+    free(*h);
+    *h = NULL;
+}
+
+const BinarySearchTree* bstree_handle_root(const BSTreeHandle* h) {
+    return h->root;
+}
+
+size_t bstree_handle_size(const BSTreeHandle* h) {
+    return h->size;
+}
+
+bool bstree_handle_add(BSTreeHandle* h, BSTreeKey v) {
+    BinarySearchTree* existing = bstree_insert(&h->root, v, &h->options.allocator, h->node_size, h->augmented, &engines[h->options.balancing]);
+    if(bstree_empty(existing)){
+        handle_created(h, v);
+        return true;
+    }
+    if(h->options.multiset){
+        ++existing->count;
+        augment_path(h->augmented, existing);
+    }
+    recency_touch(h, existing);
+    return false;
+}
+
+bool bstree_handle_remove(BSTreeHandle* h, BSTreeKey v) {
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(h->root, v);
+    if(bstree_empty(node)){
+        return false;
+    }
+    if(h->options.multiset && node->count > 1){
+        --node->count;
+        augment_path(h->augmented, node);
+    }
+    else{
+        handle_remove_node(h, node);
+    }
+    return true;
+}
+
+void bstree_handle_add_occurrences(BSTreeHandle* h, BSTreeKey v, unsigned int n) {
+    assert(n > 0);
+    BinarySearchTree* node = bstree_insert(&h->root, v, &h->options.allocator, h->node_size, h->augmented, &engines[h->options.balancing]);
+    if(bstree_empty(node)){
+        if(!handle_created(h, v) || n == 1 || !h->options.multiset){
+            return;
+        }
+        node = (BinarySearchTree*)bstree_search(h->root, v);
+        --n;
+    }
+    else{
+        recency_touch(h, node);
+    }
+    if(h->options.multiset){
+        node->count += n;
+        augment_path(h->augmented, node);
+    }
+}
+
+unsigned int bstree_handle_remove_all(BSTreeHandle* h, BSTreeKey v) {
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(h->root, v);
+    if(bstree_empty(node)){
+        return 0;
+    }
+    unsigned int count = node->count;
+    handle_remove_node(h, node);
+    return count;
+}
+
+const BinarySearchTree* bstree_handle_search(const BSTreeHandle* h, BSTreeKey v) {
+    return bstree_search(h->root, v);
+}
+
+const BinarySearchTree* bstree_handle_access(BSTreeHandle* h, BSTreeKey v) {
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(h->root, v);
+    if(!bstree_empty(node)){
+        recency_touch(h, node);
+    }
+    return node;
+}
+
+size_t bstree_handle_capacity(const BSTreeHandle* h) {
+    return h->capacity;
+}
+
+size_t bstree_handle_evictions(const BSTreeHandle* h) {
+    return h->evictions;
+}
+
+/*------------------------  BSTreeAugmented  -----------------------------*/
+
+static void sum_identity(void* summary, void* context) {
+    (void)context;
+    BSTreeSum* s = summary;
+    s->occurrences = 0;
+    s->sum = 0;
+}
+
+static void sum_lift(void* summary, BSTreeKey key, unsigned int count, const void* value, void* context) {
+    (void)value;
+    (void)context;
+    BSTreeSum* s = summary;
+    s->occurrences = count;
+    s->sum = (long long)key * count;
+}
+
+static void sum_combine(void* result, const void* a, const void* b, void* context) {
+    (void)context;
+    const BSTreeSum* x = a;
+    const BSTreeSum* y = b;
+    BSTreeSum sum = { x->occurrences + y->occurrences, x->sum + y->sum };
+    *(BSTreeSum*)result = sum;
+}
+
+void bstree_sum_augmentation(BSTreeAugmentation* augmentation) {
+    augmentation->value_size = 0;
+    augmentation->summary_size = sizeof(BSTreeSum);
+    augmentation->identity = sum_identity;
+    augmentation->lift = sum_lift;
+    augmentation->combine = sum_combine;
+    augmentation->context = NULL;
+}
+
+static void interval_identity(void* summary, void* context) {
+    (void)context;
+    *(BSTreeKey*)summary = BSTREE_KEY_MIN;
+}
+
+static void interval_lift(void* summary, BSTreeKey key, unsigned int count, const void* value, void* context) {
+    (void)key;
+    (void)count;
+    (void)context;
+    *(BSTreeKey*)summary = *(const BSTreeKey*)value;
+}
+
+static void interval_combine(void* result, const void* a, const void* b, void* context) {
+    (void)context;
+    BSTreeKey x = *(const BSTreeKey*)a;
+    BSTreeKey y = *(const BSTreeKey*)b;
+    *(BSTreeKey*)result = x > y ? x : y;
+}
+
+void bstree_interval_augmentation(BSTreeAugmentation* augmentation) {
+    augmentation->value_size = sizeof(BSTreeKey);
+    augmentation->summary_size = sizeof(BSTreeKey);
+    augmentation->identity = interval_identity;
+    augmentation->lift = interval_lift;
+    augmentation->combine = interval_combine;
+    augmentation->context = NULL;
+}
+
+bool bstree_handle_set_value(BSTreeHandle* h, BSTreeKey v, const void* value) {
+    assert(h->augmented);
+    BinarySearchTree* node = (BinarySearchTree*)bstree_search(h->root, v);
+    if(bstree_empty(node)){
+        return false;
+    }
+    memcpy(augment_value(h->augmented, node), value, h->augmented->monoid.value_size);
+    augment_path(h->augmented, node);
+    return true;
+}
+
+const void* bstree_augmented_value(const BSTreeHandle* h, const BinarySearchTree* t) {
+    assert(!bstree_empty(t) && h->augmented);
+    return augment_value(h->augmented, t);
+}
+
+void* bstree_handle_value(BSTreeHandle* h, const BinarySearchTree* t) {
+    assert(!bstree_empty(t) && h->augmented);
+    return augment_value(h->augmented, t);
+}
+
+void bstree_handle_value_changed(BSTreeHandle* h, const BinarySearchTree* t) {
+    assert(!bstree_empty(t) && h->augmented);
+    augment_path(h->augmented, (BinarySearchTree*)t);
+}
+
+const void* bstree_augmented_summary(const BSTreeHandle* h, const BinarySearchTree* t) {
+    assert(!bstree_empty(t) && h->augmented);
+    return augment_summary(h->augmented, t);
+}
+
+void bstree_handle_aggregate(const BSTreeHandle* h, BSTreeKey low, BSTreeKey high, void* result) {
+    assert(h->augmented);
+    const Augmented* a = h->augmented;
+    const BSTreeAugmentation* m = &a->monoid;
+    void* node = a->scratch;
+    m->identity(result, m->context);
+
+    //Premier noeud du chemin dont la clé est dans l'intervalle : les deux bords s'en separent
+    const BinarySearchTree* split = h->root;
+    while(!bstree_empty(split) && (split->key < low || split->key > high)){
+        split = split->key < low ? split->right : split->left;
+    }
+    if(bstree_empty(split)){
+        return;
+    }
+
+    //Bord gauche : chaque noeud de clé au moins low apporte son sous-arbre droit, par clés decroissantes
+    for(const BinarySearchTree* x = split->left; !bstree_empty(x); ){
+        if(x->key < low){
+            x = x->right;
+            continue;
+        }
+        m->lift(node, x->key, x->count, augment_value(a, x), m->context);
+        if(!bstree_empty(x->right)){
+            m->combine(node, node, augment_summary(a, x->right), m->context);
+        }
+        m->combine(result, node, result, m->context);
+        x = x->left;
+    }
+
+    m->lift(node, split->key, split->count, augment_value(a, split), m->context);
+    m->combine(result, result, node, m->context);
+
+    //Bord droit : chaque noeud de clé au plus high apporte son sous-arbre gauche, par clés croissantes
+    for(const BinarySearchTree* x = split->right; !bstree_empty(x); ){
+        if(x->key > high){
+            x = x->left;
+            continue;
+        }
+        if(!bstree_empty(x->left)){
+            m->combine(result, result, augment_summary(a, x->left), m->context);
+        }
+        m->lift(node, x->key, x->count, augment_value(a, x), m->context);
+        m->combine(result, result, node, m->context);
+        x = x->right;
+    }
+}
+
+/* Plus grande borne haute des intervalles du sous-arbre t */
+static BSTreeKey interval_max(const Augmented* a, const BinarySearchTree* t) {
+    return *(const BSTreeKey*)augment_summary(a, t);
+}
+
+/* Melange de la clé et du nombre d'occurrences d'un noeud (finaliseur de splitmix64) */
+static unsigned long long hash_node(BSTreeKey key, unsigned int count) {
+    //Avec des clés de 64 bits, le nombre d'occurrences est d'abord melange a la clé par une multiplication impaire
+    unsigned long long h = sizeof(BSTreeKey) > 4 ? (unsigned long long)key ^ (count * 0x9e3779b97f4a7c15ull) : (unsigned long long)(unsigned int)key << 32 | count;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+static void hash_identity(void* summary, void* context) {
+    (void)context;
+    BSTreeHash* s = summary;
+    s->hash = 0;
+    s->nodes = 0;
+}
+
+static void hash_lift(void* summary, BSTreeKey key, unsigned int count, const void* value, void* context) {
+    (void)value;
+    (void)context;
+    BSTreeHash* s = summary;
+    s->hash = hash_node(key, count);
+    s->nodes = 1;
+}
+
+static void hash_combine(void* result, const void* a, const void* b, void* context) {
+    (void)context;
+    const BSTreeHash* x = a;
+    const BSTreeHash* y = b;
+    BSTreeHash hash = { x->hash + y->hash, x->nodes + y->nodes };
+    *(BSTreeHash*)result = hash;
+}
+
+void bstree_hash_augmentation(BSTreeAugmentation* augmentation) {
+    augmentation->value_size = 0;
+    augmentation->summary_size = sizeof(BSTreeHash);
+    augmentation->identity = hash_identity;
+    augmentation->lift = hash_lift;
+    augmentation->combine = hash_combine;
+    augmentation->context = NULL;
+}
+
+/* En dessous de ce nombre de noeuds dans chaque arbre, un intervalle different est compare par fusion */
+#define DIFF_MERGE_NODES 32
+
+/* Compare les clés de [low, high] des deux arbres : les intervalles de meme hachage sont sautes, les autres sont
+ * coupes en deux jusqu'a etre assez petits pour etre fusionnes.
+ */
+static void diff_hashed(const BSTreeHandle* a, const BSTreeHandle* b, BSTreeKey low, BSTreeKey high, OperateFunctor on_added, OperateFunctor on_removed, void* environment) {
+    BSTreeHash x, y;
+    bstree_handle_aggregate(a, low, high, &x);
+    bstree_handle_aggregate(b, low, high, &y);
+    if(x.hash == y.hash && x.nodes == y.nodes){
+        return;
+    }
+    if(low == high || (x.nodes <= DIFF_MERGE_NODES && y.nodes <= DIFF_MERGE_NODES)){
+        diff_merge(lower_bound(a->root, low), lower_bound(b->root, low), high, on_added, on_removed, environment);
+        return;
+    }
+    //La largeur de [low, high] peut depasser BSTREE_KEY_MAX, elle est calculee en non signe
+    BSTreeKey middle = low + (BSTreeKey)(((unsigned long long)high - (unsigned long long)low) / 2);
+    diff_hashed(a, b, low, middle, on_added, on_removed, environment);
+    diff_hashed(a, b, middle + 1, high, on_added, on_removed, environment);
+}
+
+void bstree_handle_diff(const BSTreeHandle* a, const BSTreeHandle* b, OperateFunctor on_added, OperateFunctor on_removed, void* environment) {
+    assert(a->augmented && a->augmented->monoid.combine == hash_combine);
+    assert(b->augmented && b->augmented->monoid.combine == hash_combine);
+    diff_hashed(a, b, BSTREE_KEY_MIN, BSTREE_KEY_MAX, on_added, on_removed, environment);
+}
+
+static bool interval_overlaps(const Augmented* a, const BinarySearchTree* t, BSTreeKey low, BSTreeKey high) {
+    return t->key <= high && *(const BSTreeKey*)augment_value(a, t) >= low;
+}
+
+bool bstree_handle_add_interval(BSTreeHandle* h, BSTreeKey low, BSTreeKey high) {
+    assert(h->augmented && h->augmented->monoid.combine == interval_combine);
+    bstree_handle_add(h, low);
+    return bstree_handle_set_value(h, low, &high);
+}
+
+const BinarySearchTree* bstree_handle_overlap(const BSTreeHandle* h, BSTreeKey low, BSTreeKey high) {
+    assert(h->augmented && h->augmented->monoid.combine == interval_combine);
+    const BinarySearchTree* x = h->root;
+    while(!bstree_empty(x) && !interval_overlaps(h->augmented, x, low, high)){
+        //Si aucun intervalle du sous-arbre gauche n'atteint low, seul le sous-arbre droit peut convenir. Sinon,
+        //un intervalle gauche atteint low et commence avant x : si aucun ne convient, x et sa droite non plus.
+        if(!bstree_empty(x->left) && interval_max(h->augmented, x->left) >= low){
+            x = x->left;
+        }
+        else{
+            x = x->right;
+        }
+    }
+    return x;
+}
+
+static void overlaps_visit(const Augmented* a, const BinarySearchTree* t, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment) {
+    if(bstree_empty(t) || interval_max(a, t) < low){
+        return;
+    }
+    overlaps_visit(a, t->left, low, high, f, environment);
+    if(t->key > high){
+        return;
+    }
+    if(interval_overlaps(a, t, low, high)){
+        f(t, environment);
+    }
+    overlaps_visit(a, t->right, low, high, f, environment);
+}
+
+void bstree_handle_overlaps(const BSTreeHandle* h, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment) {
+    assert(h->augmented && h->augmented->monoid.combine == interval_combine);
+    overlaps_visit(h->augmented, h->root, low, high, f, environment);
+}
+
+/*------------------------  BSTreeIterator  -----------------------------*/
+
+struct _BSTreeIterator {
+    /* the collection the iterator is attached to */
+    const BinarySearchTree* collection;
+    /* the first element according to the iterator direction */
+    const BinarySearchTree* (*begin)(const BinarySearchTree* );
+    /* the current element pointed by the iterator */
+    const BinarySearchTree* current;
+    /* function that goes to the next element according to the iterator direction */
+    const BinarySearchTree* (*next)(const BinarySearchTree* );
+    /* if true, a node is visited as many times as its key occurs in the multiset */
+    bool expand_duplicates;
+    /* number of times the current node has already been visited */
+    unsigned int occurrence;
+};
+
+/* minimum element of the collection */
+const BinarySearchTree* goto_min(const BinarySearchTree* e) {
+    if(bstree_empty(e)){
+        return e;
+    }
+    while(!bstree_empty(bstree_left(e))){
+        e = bstree_left(e);
+    }
+    return e;
+}
+
+/* maximum element of the collection */
+const BinarySearchTree* goto_max(const BinarySearchTree* e) {
+    if(bstree_empty(e)){
+        return e;
+    }
+    while(!bstree_empty(bstree_right(e))){
+        e = bstree_right(e);
+    }
+    return e;
+}
+
+/* constructor */
 BSTreeIterator* bstree_iterator_create(const BinarySearchTree* collection, IteratorDirection direction) {
-	(void)collection; (void)direction;
-	return NULL;
+    BSTreeIterator* i = malloc(sizeof(struct _BSTreeIterator));
+    i->collection = collection;
+    if(direction == forward){
+        i->begin = goto_min;
+        i->next = bstree_successor;
+    }
+    else{
+        i->begin = goto_max;
+        i->next = bstree_predecessor;
+    }
+    i->current = NULL;
+    i->expand_duplicates = false;
+    i->occurrence = 0;
+    return i;
+}
+
+BSTreeIterator* bstree_multiset_iterator_create(const BinarySearchTree* collection, IteratorDirection direction) {
+    BSTreeIterator* i = bstree_iterator_create(collection, direction);
+    i->expand_duplicates = true;
+    return i;
 }
 
 /* destructor */
@@ -403,6 +1499,7 @@ void bstree_iterator_delete(ptrBSTreeIterator* i) {
 
 BSTreeIterator* bstree_iterator_begin(BSTreeIterator* i) {
     i->current = i->begin(i->collection);
+    i->occurrence = 0;
     return i;
 }
 
@@ -411,7 +1508,12 @@ bool bstree_iterator_end(const BSTreeIterator* i) {
 }
 
 BSTreeIterator* bstree_iterator_next(BSTreeIterator* i) {
+    if(i->expand_duplicates && i->occurrence + 1 < i->current->count){
+        ++i->occurrence;
+        return i;
+    }
     i->current = i->next(i->current);
+    i->occurrence = 0;
     return i;
 }
 
@@ -422,31 +1524,31 @@ const BinarySearchTree* bstree_iterator_value(const BSTreeIterator* i) {
 /*------------------------  BSTreeAffichage  -----------------------------*/
 void bstree_node_to_dot(const BinarySearchTree* t, void* stream) {
     FILE *file = (FILE *) stream;
-    printf("%d ", bstree_key(t));
+    printf("%" BSTREE_KEY_FORMAT " ", bstree_key(t));
 
     // Affichage des nœuds avec une couleur rouge si leur couleur est "red"
-    fprintf(file, "\tn%d [label=\"{%d|{<left>|<right>}}\", style=filled, fillcolor=%s];\n",
+    fprintf(file, "\tn%" BSTREE_KEY_FORMAT " [label=\"{%" BSTREE_KEY_FORMAT "|{<left>|<right>}}\", style=filled, fillcolor=%s];\n",
             bstree_key(t), 
             bstree_key(t),
             (t->color == red) ? "red" : "white");
 
     // Lien vers le fils gauche
     if (bstree_left(t)) {
-        fprintf(file, "\tn%d:left:c -> n%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":left:c -> n%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(bstree_left(t)));
     } else {
-        fprintf(file, "\tlnil%d [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
-        fprintf(file, "\tn%d:left:c -> lnil%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\tlnil%" BSTREE_KEY_FORMAT " [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":left:c -> lnil%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(t));
     }
 
     // Lien vers le fils droit
     if (bstree_right(t)) {
-        fprintf(file, "\tn%d:right:c -> n%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":right:c -> n%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(bstree_right(t)));
     } else {
-        fprintf(file, "\trnil%d [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
-        fprintf(file, "\tn%d:right:c -> rnil%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\trnil%" BSTREE_KEY_FORMAT " [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":right:c -> rnil%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(t));
     }
 }
@@ -461,15 +1563,16 @@ bool is_root_child(BinarySearchTree* x){
 
 /*Declaration des fonctions de gestion de l'invariant*/
 
-BinarySearchTree* fixredblack_insert_case1(BinarySearchTree* x);
-BinarySearchTree* fixredblack_insert_case1(BinarySearchTree* x);
-BinarySearchTree* fixredblack_insert_case2(BinarySearchTree* x);
+BinarySearchTree* fixredblack_insert_case1(BinarySearchTree* x, const Augmented* a);
+BinarySearchTree* fixredblack_insert_case1(BinarySearchTree* x, const Augmented* a);
+BinarySearchTree* fixredblack_insert_case2(BinarySearchTree* x, const Augmented* a);
 
 /******************************************************/
 
 
 /*------------------------  BSTreeInvariants  -----------------------------*/
-BinarySearchTree* fixredblack_insert(BinarySearchTree* x){
+/* Correction apres l'insertion de x, qui maintient les resumes de a si l'arbre est augmente */
+static BinarySearchTree* fixredblack_insert_case0(BinarySearchTree* x, const Augmented* a){
     //Un traitement est à effectuer si et seulement si x est rouge et x est le fils d'un noeud rouge
     if((!bstree_empty(x) && x->color == red) && (!bstree_empty(x->parent) && x->parent->color == red)){
         //Cas 0 : x est le fils de la racine
@@ -479,53 +1582,637 @@ BinarySearchTree* fixredblack_insert(BinarySearchTree* x){
         }
         //Sinon traitement cas 1
         else{
-            return fixredblack_insert_case1(x);
+            return fixredblack_insert_case1(x, a);
         }
     }
     return x;
 }
 
+BinarySearchTree* fixredblack_insert(BinarySearchTree* x){
+    return fixredblack_insert_case0(x, NULL);
+}
 
-BinarySearchTree* fixredblack_insert_case1(BinarySearchTree* x){
+
+BinarySearchTree* fixredblack_insert_case1(BinarySearchTree* x, const Augmented* a){
     //Verification existance oncle de x, comme le pere de x n'est pas la racine de l'arbre on verifie simplement que l'oncle n'est pas une feuille
     if(!bstree_empty(uncle(x))){
         BinarySearchTree* x_uncle = uncle(x);
         if(x_uncle->color == red){
             x->parent->color = black; //p devient noir
             x_uncle->color = black;   //f devient noir 
-            x_uncle->parent = red;    //pp devient rouge
-            return fixredblack_insert(x_uncle->parent);
+            x_uncle->parent->color = red;    //pp devient rouge
+            return fixredblack_insert_case0(x_uncle->parent, a);
         }
     }
-    return fixredblack_insert_case2(x);
+    return fixredblack_insert_case2(x, a);
 }
 
 /**Fonctions intermediaire du cas 2**/
-BinarySearchTree* fixredblack_insert_case2_left(BinarySearchTree* x){
-    //Cas ou x est le fils gauche de p
+BinarySearchTree* fixredblack_insert_case2_left(BinarySearchTree* x, const Augmented* a){
+    //Cas ou p est le fils gauche de pp
     BinarySearchTree* p = x->parent;
     BinarySearchTree* pp = p->parent;
-    rightrotate(pp);
+    //x fils droit de p : on se ramene au cas ou x est fils gauche
+    if(p->right == x){
+        leftrotate(p, a);
+        p = x;
+    }
+    rightrotate(pp, a);
     p->color = black;
     pp->color = red;
-    return x;
+    return p;
 } 
 
-BinarySearchTree* fixredblack_insert_case2_right(BinarySearchTree* x){
+BinarySearchTree* fixredblack_insert_case2_right(BinarySearchTree* x, const Augmented* a){
+    //Cas ou p est le fils droit de pp, symetrique du precedent
     BinarySearchTree* p = x->parent;
-    leftrotate(p);
-    return fixredblack_insert_case2_left(p); //A VOIR PEUT ETRE X
+    BinarySearchTree* pp = p->parent;
+    if(p->left == x){
+        rightrotate(p, a);
+        p = x;
+    }
+    leftrotate(pp, a);
+    p->color = black;
+    pp->color = red;
+    return p;
 }
 
 /********************************************/
-BinarySearchTree* fixredblack_insert_case2(BinarySearchTree* x){
-    //Cas x est le fils gauche de p
+BinarySearchTree* fixredblack_insert_case2(BinarySearchTree* x, const Augmented* a){
+    //Cas p est le fils gauche de pp
+    if(grandparent(x)->left == x->parent){
+        return fixredblack_insert_case2_left(x, a);
+    }
+    //Cas p est le fils droit de pp
+    else{
+        return fixredblack_insert_case2_right(x, a);
+    }
+}
+
+/* Retablit l'invariant avant le retrait du noeud noir x, qui n'a pas de fils : le chemin passant par x va
+ * perdre un noeud noir, on le compense en remontant dans l'arbre.
+ */
+void fixredblack_remove(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a){
+    while(!bstree_empty(x->parent) && x->color == black){
+        BinarySearchTree* p = x->parent;
+        if(p->left == x){
+            BinarySearchTree* s = p->right;
+            //Cas 1 : frere rouge, on se ramene a un frere noir
+            if(s->color == red){
+                s->color = black;
+                p->color = red;
+                leftrotate(p, a);
+                s = p->right;
+            }
+            //Cas 2 : frere noir avec deux fils noirs, on le colore en rouge et on remonte
+            if((bstree_empty(s->left) || s->left->color == black) && (bstree_empty(s->right) || s->right->color == black)){
+                s->color = red;
+                x = p;
+            }
+            else{
+                //Cas 3 : seul le fils gauche du frere est rouge, on se ramene au cas 4
+                if(bstree_empty(s->right) || s->right->color == black){
+                    s->left->color = black;
+                    s->color = red;
+                    rightrotate(s, a);
+                    s = p->right;
+                }
+                //Cas 4 : le fils droit du frere est rouge
+                s->color = p->color;
+                p->color = black;
+                s->right->color = black;
+                leftrotate(p, a);
+                break;
+            }
+        }
+        else{
+            //Cas symetriques
+            BinarySearchTree* s = p->left;
+            if(s->color == red){
+                s->color = black;
+                p->color = red;
+                rightrotate(p, a);
+                s = p->left;
+            }
+            if((bstree_empty(s->left) || s->left->color == black) && (bstree_empty(s->right) || s->right->color == black)){
+                s->color = red;
+                x = p;
+            }
+            else{
+                if(bstree_empty(s->left) || s->left->color == black){
+                    s->right->color = black;
+                    s->color = red;
+                    leftrotate(s, a);
+                    s = p->left;
+                }
+                s->color = p->color;
+                p->color = black;
+                s->left->color = black;
+                rightrotate(p, a);
+                break;
+            }
+        }
+    }
+    x->color = black;
+
+    //Les rotations ont pu changer la racine
+    while(!bstree_empty((*t)->parent)){
+        *t = (*t)->parent;
+    }
+}
+
+/*------------------------  BSTreeEngines  -----------------------------*/
+
+/* Remonte *t jusqu'a la racine de l'arbre apres des rotations */
+static void update_root(ptrBinarySearchTree* t) {
+    while(!bstree_empty(*t) && !bstree_empty((*t)->parent)){
+        *t = (*t)->parent;
+    }
+}
+
+/* Rouge-noir : correction ascendante a partir de la feuille inseree */
+static void redblack_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    fixredblack_insert_case0(x, a);
+    //Les rotations ont pu changer la racine : on remonte jusqu'a elle et on la colore en noir
+    update_root(t);
+    (*t)->color = black;
+}
+
+/* AVL : rank est la hauteur du sous-arbre */
+static int avl_height(const BinarySearchTree* t) {
+    return bstree_empty(t) ? 0 : t->rank;
+}
+
+static void avl_update(BinarySearchTree* t) {
+    int left = avl_height(t->left);
+    int right = avl_height(t->right);
+    t->rank = 1 + (left > right ? left : right);
+}
+
+/* Retablit l'equilibre du noeud x, dont les sous-arbres sont equilibres, et retourne la racine du sous-arbre */
+static BinarySearchTree* avl_rebalance(BinarySearchTree* x, const Augmented* a) {
+    int balance = avl_height(x->left) - avl_height(x->right);
+    if(balance > 1){
+        //Cas gauche-droite : on se ramene au cas gauche-gauche
+        if(avl_height(x->left->left) < avl_height(x->left->right)){
+            BinarySearchTree* l = x->left;
+            leftrotate(l, a);
+            avl_update(l);
+            avl_update(l->parent);
+        }
+        rightrotate(x, a);
+    }
+    else if(balance < -1){
+        if(avl_height(x->right->right) < avl_height(x->right->left)){
+            BinarySearchTree* r = x->right;
+            rightrotate(r, a);
+            avl_update(r);
+            avl_update(r->parent);
+        }
+        leftrotate(x, a);
+    }
+    else{
+        avl_update(x);
+        return x;
+    }
+    avl_update(x);
+    avl_update(x->parent);
+    return x->parent;
+}
+
+/* Met a jour les hauteurs et reequilibre de x jusqu'a la racine */
+static void avl_retrace(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    while(!bstree_empty(x)){
+        x = avl_rebalance(x, a);
+        if(bstree_empty(x->parent)){
+            *t = x;
+        }
+        x = x->parent;
+    }
+}
+
+static void avl_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    x->rank = 1;
+    avl_retrace(t, x->parent, a);
+}
+
+static void avl_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    if(!bstree_empty(x->left) && !bstree_empty(x->right)){
+        bstree_swap_nodes(t, x, right_min(x));
+    }
+    BinarySearchTree* parent = x->parent;
+    splice_node(t, x);
+    avl_retrace(t, parent, a);
+    augment_path(a, parent);
+}
+
+/* Treap : rank est une priorite pseudo-aleatoire derivee de la clé, les priorites forment un tas */
+static int treap_priority(BSTreeKey key) {
+    unsigned int h = (unsigned int)key ^ (sizeof(BSTreeKey) > 4 ? (unsigned int)((unsigned long long)key >> 32) : 0u);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return (int)(h >> 1);
+}
+
+/* Fait remonter x a la place de son parent */
+static void treap_rotate_up(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
     if(x->parent->left == x){
-        return fixredblack_insert_case2_left(x);
+        rightrotate(x->parent, a);
     }
-    //Cas x est le fils droit de p
     else{
-        return fixredblack_insert_case2_right(x);
+        leftrotate(x->parent, a);
+    }
+    if(bstree_empty(x->parent)){
+        *t = x;
+    }
+}
+
+static void treap_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    x->rank = treap_priority(x->key);
+    while(!bstree_empty(x->parent) && x->parent->rank < x->rank){
+        treap_rotate_up(t, x, a);
+    }
+}
+
+static void treap_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    //x descend sous son fils le plus prioritaire jusqu'a avoir au plus un fils
+    while(!bstree_empty(x->left) && !bstree_empty(x->right)){
+        treap_rotate_up(t, x->left->rank > x->right->rank ? x->left : x->right, a);
+    }
+    splice_node(t, x);
+    augment_path(a, x->parent);
+}
+
+/* Rouge-noir penche a gauche (LLRB, Sedgewick) : un lien rouge est toujours un lien gauche */
+static bool is_red(const BinarySearchTree* t) {
+    return !bstree_empty(t) && t->color == red;
+}
+
+static void set_left(BinarySearchTree* t, BinarySearchTree* child) {
+    t->left = child;
+    if(!bstree_empty(child)){
+        child->parent = t;
+    }
+}
+
+static void set_right(BinarySearchTree* t, BinarySearchTree* child) {
+    t->right = child;
+    if(!bstree_empty(child)){
+        child->parent = t;
+    }
+}
+
+static BinarySearchTree* llrb_rotate_left(BinarySearchTree* h, const Augmented* a) {
+    BinarySearchTree* x = h->right;
+    leftrotate(h, a);
+    x->color = h->color;
+    h->color = red;
+    return x;
+}
+
+static BinarySearchTree* llrb_rotate_right(BinarySearchTree* h, const Augmented* a) {
+    BinarySearchTree* x = h->left;
+    rightrotate(h, a);
+    x->color = h->color;
+    h->color = red;
+    return x;
+}
+
+static void llrb_flip(BinarySearchTree* h) {
+    h->color = h->color == red ? black : red;
+    h->left->color = h->left->color == red ? black : red;
+    h->right->color = h->right->color == red ? black : red;
+}
+
+static BinarySearchTree* llrb_balance(BinarySearchTree* h, const Augmented* a) {
+    if(is_red(h->right) && !is_red(h->left)){
+        h = llrb_rotate_left(h, a);
+    }
+    if(is_red(h->left) && is_red(h->left->left)){
+        h = llrb_rotate_right(h, a);
+    }
+    if(is_red(h->left) && is_red(h->right)){
+        llrb_flip(h);
+    }
+    //La suppression reequilibre chaque noeud du chemin en remontant, ses fils ont pu changer
+    if(a){
+        augment_update(a, h);
     }
+    return h;
 }
 
+static void llrb_insert(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    //Equivalent iteratif de l'insertion recursive : chaque ancetre de x est reequilibre en remontant
+    BinarySearchTree* h = x->parent;
+    while(!bstree_empty(h)){
+        h = llrb_balance(h, a);
+        if(bstree_empty(h->parent)){
+            *t = h;
+        }
+        h = h->parent;
+    }
+    (*t)->color = black;
+}
+
+static BinarySearchTree* llrb_move_red_left(BinarySearchTree* h, const Augmented* a) {
+    llrb_flip(h);
+    if(is_red(h->right->left)){
+        llrb_rotate_right(h->right, a);
+        h = llrb_rotate_left(h, a);
+        llrb_flip(h);
+    }
+    return h;
+}
+
+static BinarySearchTree* llrb_move_red_right(BinarySearchTree* h, const Augmented* a) {
+    llrb_flip(h);
+    if(is_red(h->left->left)){
+        h = llrb_rotate_right(h, a);
+        llrb_flip(h);
+    }
+    return h;
+}
+
+/* Detache le minimum du sous-arbre h, retourne la nouvelle racine du sous-arbre et le minimum dans *min */
+static BinarySearchTree* llrb_delete_min(BinarySearchTree* h, BinarySearchTree** min, const Augmented* a) {
+    if(bstree_empty(h->left)){
+        //Sans fils gauche, h n'a pas de fils droit dans un LLRB
+        *min = h;
+        return NULL;
+    }
+    if(!is_red(h->left) && !is_red(h->left->left)){
+        h = llrb_move_red_left(h, a);
+    }
+    set_left(h, llrb_delete_min(h->left, min, a));
+    return llrb_balance(h, a);
+}
+
+/* Retire x du sous-arbre h et retourne la nouvelle racine du sous-arbre.
+ * Le noeud x est remplace par son successeur plutot que de recopier la clé, pour garder les noeuds en place.
+ */
+static BinarySearchTree* llrb_delete(BinarySearchTree* h, BinarySearchTree* x, const Augmented* a) {
+    if(x->key < h->key){
+        if(!is_red(h->left) && !is_red(h->left->left)){
+            h = llrb_move_red_left(h, a);
+        }
+        set_left(h, llrb_delete(h->left, x, a));
+    }
+    else{
+        if(is_red(h->left)){
+            h = llrb_rotate_right(h, a);
+        }
+        if(h == x && bstree_empty(h->right)){
+            return NULL;
+        }
+        if(!is_red(h->right) && !is_red(h->right->left)){
+            h = llrb_move_red_right(h, a);
+        }
+        if(h == x){
+            BinarySearchTree* min;
+            BinarySearchTree* right = llrb_delete_min(h->right, &min, a);
+            min->color = h->color;
+            min->parent = h->parent;
+            set_left(min, h->left);
+            set_right(min, right);
+            h = min;
+        }
+        else{
+            set_right(h, llrb_delete(h->right, x, a));
+        }
+    }
+    return llrb_balance(h, a);
+}
+
+static void llrb_unlink(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    if(!is_red((*t)->left) && !is_red((*t)->right)){
+        (*t)->color = red;
+    }
+    *t = llrb_delete(*t, x, a);
+    if(!bstree_empty(*t)){
+        (*t)->parent = NULL;
+        (*t)->color = black;
+    }
+}
+
+/* Rouge-noir descendant : les 4-noeuds (noeuds noirs a deux fils rouges) sont eclates pendant la descente.
+ * Un parent rouge a alors toujours un frere noir, une rotation suffit a corriger un conflit rouge-rouge et
+ * aucune remontee n'est necessaire apres l'ajout de la feuille : chaque noeud du chemin est visite une fois,
+ * et toutes les modifications restent dans la fenetre x, parent, grand-parent et arriere-grand-parent.
+ */
+
+/* x est rouge et son parent aussi : rotation simple ou double autour du grand-parent, qui est noir */
+static void topdown_rotate(ptrBinarySearchTree* t, BinarySearchTree* x, const Augmented* a) {
+    BinarySearchTree* p = x->parent;
+    BinarySearchTree* g = p->parent;
+    BinarySearchTree* top;
+    if(p == g->left){
+        if(x == p->right){
+            leftrotate(p, a);
+            top = x;
+        }
+        else{
+            top = p;
+        }
+        rightrotate(g, a);
+    }
+    else{
+        if(x == p->left){
+            rightrotate(p, a);
+            top = x;
+        }
+        else{
+            top = p;
+        }
+        leftrotate(g, a);
+    }
+    top->color = black;
+    g->color = red;
+    if(bstree_empty(top->parent)){
+        *t = top;
+    }
+}
+
+static BinarySearchTree* redblack_topdown_insert(ptrBinarySearchTree* t, BSTreeKey v, const BSTreeAllocator* allocator, size_t size, Augmented* augmented) {
+    BinarySearchTree* x = *t;
+    BinarySearchTree* parent = NULL;
+    while(!bstree_empty(x)){
+        //Eclatement d'un 4-noeud, un noeud rouge n'a que des fils noirs : on evite alors de lire ses fils
+        if(x->color == black && is_red(x->left) && is_red(x->right)){
+            x->color = red;
+            x->left->color = black;
+            x->right->color = black;
+            if(is_red(x->parent)){
+                topdown_rotate(t, x, augmented);
+            }
+        }
+        if(x->key == v){
+            (*t)->color = black;
+            return x;
+        }
+        parent = x;
+        x = v < x->key ? x->left : x->right;
+    }
+
+    BinarySearchTree* newNode = bstree_cons(allocator,size,augmented,NULL,NULL,v);
+    newNode->parent = parent;
+    if(bstree_empty(parent)){
+        *t = newNode;
+    }
+    else if(v < parent->key){
+        parent->left = newNode;
+    }
+    else{
+        parent->right = newNode;
+    }
+    thread_leaf(newNode);
+    if(is_red(parent)){
+        topdown_rotate(t, newNode, augmented);
+    }
+    (*t)->color = black;
+    augment_path(augmented, newNode);
+    return NULL;
+}
+
+/*------------------------  BSTreeCheck  -----------------------------*/
+
+typedef struct {
+    BalancingPolicy balancing;
+    bool multiset;
+    /* previous node of the infix walk */
+    const BinarySearchTree* last;
+    size_t nodes;
+    const char* error;
+    /* monoid of the nodes, and buffer of the expected summary if not NULL */
+    const Augmented* augmented;
+    void* summary;
+} CheckState;
+
+/* Verifie le sous-arbre t et retourne sa hauteur noire pour les moteurs rouge-noir, sa hauteur sinon */
+static int check_node(const BinarySearchTree* t, const BinarySearchTree* parent, CheckState* s) {
+    if(bstree_empty(t) || s->error){
+        return 0;
+    }
+    if(t->parent != parent){
+        s->error = "wrong parent link";
+        return 0;
+    }
+    if(t->count == 0 || (!s->multiset && t->count != 1)){
+        s->error = "wrong number of occurrences";
+        return 0;
+    }
+    int left = check_node(t->left, t, s);
+    if(s->error){
+        return 0;
+    }
+    if(!bstree_empty(s->last) && s->last->key >= t->key){
+        s->error = "keys not in increasing order";
+        return 0;
+    }
+#ifdef BSTREE_THREADED
+    if(t->prev != s->last || (!bstree_empty(s->last) && s->last->next != t)){
+        s->error = "wrong in-order links";
+        return 0;
+    }
+#endif
+    s->last = t;
+    ++s->nodes;
+    int right = check_node(t->right, t, s);
+    if(s->error){
+        return 0;
+    }
+    //Les resumes des fils sont corrects : celui de t doit en etre la combinaison
+    if(s->augmented){
+        augment_compute(s->augmented, t, s->summary);
+        if(memcmp(s->summary, augment_summary(s->augmented, t), s->augmented->monoid.summary_size) != 0){
+            s->error = "wrong summary";
+            return 0;
+        }
+    }
+
+    switch(s->balancing){
+        case balancing_avl:
+            if(t->rank != 1 + (left > right ? left : right)){
+                s->error = "wrong AVL height";
+            }
+            else if(left - right > 1 || right - left > 1){
+                s->error = "unbalanced AVL node";
+            }
+            return t->rank;
+        case balancing_treap:
+            if(t->rank != treap_priority(t->key)){
+                s->error = "wrong treap priority";
+            }
+            else if((!bstree_empty(t->left) && t->left->rank > t->rank) ||
+                    (!bstree_empty(t->right) && t->right->rank > t->rank)){
+                s->error = "treap heap order violated";
+            }
+            return 1 + (left > right ? left : right);
+        case balancing_llrb:
+            if(is_red(t->right)){
+                s->error = "red right link in a left-leaning tree";
+                return 0;
+            }
+            /* fall through */
+        default:
+            if(t->color == red && (is_red(t->left) || is_red(t->right))){
+                s->error = "red node with a red child";
+            }
+            else if(left != right){
+                s->error = "different black heights";
+            }
+            return left + (t->color == black);
+    }
+}
+
+static const char* check_tree(const BinarySearchTree* t, BalancingPolicy balancing, bool multiset, const Augmented* augmented, size_t* nodes) {
+    CheckState s = { balancing, multiset, NULL, 0, NULL, augmented, NULL };
+    if(augmented){
+        s.summary = malloc(augmented->monoid.summary_size);
+    }
+    check_node(t, NULL, &s);
+    free(s.summary);
+#ifdef BSTREE_THREADED
+    if(!s.error && !bstree_empty(s.last) && !bstree_empty(s.last->next)){
+        s.error = "wrong in-order links";
+    }
+#endif
+    if(!s.error && balancing != balancing_avl && balancing != balancing_treap && is_red(t)){
+        s.error = "red root";
+    }
+    *nodes = s.nodes;
+    return s.error;
+}
+
+const char* bstree_check(const BinarySearchTree* t) {
+    size_t nodes;
+    return check_tree(t, balancing_redblack, true, NULL, &nodes);
+}
+
+const char* bstree_handle_check(const BSTreeHandle* h) {
+    size_t nodes;
+    const char* error = check_tree(h->root, h->options.balancing, h->options.multiset, h->augmented, &nodes);
+    if(error){
+        return error;
+    }
+    if(nodes != h->size){
+        return "wrong size";
+    }
+    if(h->capacity && h->size > h->capacity){
+        return "capacity exceeded";
+    }
+    if(!tracks_recency(h)){
+        return bstree_empty(h->oldest) && bstree_empty(h->newest) ? NULL : "unexpected recency list";
+    }
+    const BinarySearchTree* older = NULL;
+    nodes = 0;
+    for(const BinarySearchTree* x = h->oldest; !bstree_empty(x); x = recency(x)->newer){
+        if(recency(x)->older != older || ++nodes > h->size){
+            return "wrong recency list";
+        }
+        older = x;
+    }
+    return nodes == h->size && older == h->newest ? NULL : "wrong recency list";
+}
@@ -9,6 +9,8 @@
 #ifndef __BSTREE__H__
 #define __BSTREE__H__
 #include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
 
 /*------------------------  BSTreeType  -----------------------------*/
 
@@ -26,6 +28,60 @@ typedef struct _bstree BinarySearchTree;
 typedef BinarySearchTree* ptrBinarySearchTree;
 /** @} */
 
+/** \defgroup BSTreeKey Type of the keys.
+ * @{
+ * The keys are int by default. When the library and all its users are compiled with BSTREE_KEY64 (make KEY64=yes)
+ * they are 64 bits integers, large enough for 64 bits identifiers and for composite keys such as (tenant,
+ * timestamp), see bstree_key_compose. The key is stored in the node itself : the descent of the tree compares it
+ * with the searched key as a single integer comparison, without reading any other memory.
+ */
+#ifdef BSTREE_KEY64
+typedef long long BSTreeKey;
+#define BSTREE_KEY_MIN LLONG_MIN
+#define BSTREE_KEY_MAX LLONG_MAX
+/** Conversion of a key for printf and scanf, used as "%" BSTREE_KEY_FORMAT. */
+#define BSTREE_KEY_FORMAT "lld"
+#else
+typedef int BSTreeKey;
+#define BSTREE_KEY_MIN INT_MIN
+#define BSTREE_KEY_MAX INT_MAX
+#define BSTREE_KEY_FORMAT "d"
+#endif
+
+/** Number of bits of each half of a composite key : 32 with BSTREE_KEY64, 16 otherwise. */
+#define BSTREE_KEY_HALF_BITS ((int)sizeof(BSTreeKey) * 4)
+
+/** Constructor : composite key ordered by high then by low, for instance (tenant, timestamp).
+ * The composite keys compare as the pairs (high, low) in lexicographic order.
+ * @pre high is a signed and low an unsigned integer of BSTREE_KEY_HALF_BITS bits.
+ */
+BSTreeKey bstree_key_compose(BSTreeKey high, BSTreeKey low);
+
+/** Operator : first part of a composite key.
+ */
+BSTreeKey bstree_key_high(BSTreeKey key);
+
+/** Operator : second part of a composite key.
+ */
+BSTreeKey bstree_key_low(BSTreeKey key);
+
+/** Operator : reads a key, written as an integer or as a composite key "high:low", at the start of text.
+ * Leading white spaces are skipped.
+ * @param key receives the key read.
+ * @return the first character after the key, or NULL if text does not start with a key.
+ */
+const char* bstree_key_parse(const char* text, BSTreeKey* key);
+/** @} */
+
+/* The release build defines BSTREE_INLINE_ACCESSORS so that the accessors below are inlined in the hot paths
+ * of the users of the tree, see bstree_node.h. The API and the exported functions are the same in both cases.
+ */
+#ifdef BSTREE_INLINE_ACCESSORS
+#define BSTREE_ACCESSOR inline
+#else
+#define BSTREE_ACCESSOR
+#endif
+
 /*------------------------  BaseBSTree  -----------------------------*/
 
 /** \defgroup BaseBSTree General function on binary trees.
@@ -43,27 +99,31 @@ void bstree_delete(ptrBinarySearchTree* t);
 /** Operator : is the tree empty ?
  * bstree_empty : BinarySearchTree -> boolean
  */
-bool bstree_empty(const BinarySearchTree* t);
+BSTREE_ACCESSOR bool bstree_empty(const BinarySearchTree* t);
 
 /** Operator : returns the value of the root of the tree.
  * @pre !bstree_empty(t)
  */
-int bstree_key(const BinarySearchTree* t);
+BSTREE_ACCESSOR BSTreeKey bstree_key(const BinarySearchTree* t);
 
 /** Operator : returns the left subtree.
  * @pre !bstree_empty(t)
  */
-BinarySearchTree* bstree_left(const BinarySearchTree* t);
+BSTREE_ACCESSOR BinarySearchTree* bstree_left(const BinarySearchTree* t);
 
 /** Operator : returns the right subtree.
  * @pre !bstree_empty(t)
  */
-BinarySearchTree* bstree_right(const BinarySearchTree* t);
+BSTREE_ACCESSOR BinarySearchTree* bstree_right(const BinarySearchTree* t);
 
 /** Operator : returns the parent subtree
  * @pre !bstree_empty(t)
  */
-BinarySearchTree* bstree_parent(const BinarySearchTree* t);
+BSTREE_ACCESSOR BinarySearchTree* bstree_parent(const BinarySearchTree* t);
+
+/** Operator : number of nodes on the longest path from the root to a leaf, 0 for an empty tree.
+ */
+int bstree_height(const BinarySearchTree* t);
 
 /** @} */
 
@@ -77,21 +137,64 @@ BinarySearchTree* bstree_parent(const BinarySearchTree* t);
  * @param t
  * @param v
  */
-void bstree_add(ptrBinarySearchTree* t, int v);
+void bstree_add(ptrBinarySearchTree* t, BSTreeKey v);
 
 /** Operator : search for the subtree having a given value as root.
  */
-const BinarySearchTree* bstree_search(const BinarySearchTree* t, int v);
+const BinarySearchTree* bstree_search(const BinarySearchTree* t, BSTreeKey v);
 
-/** Operator : search for the subtree who is the successor of the given subtree.*/
-const BinarySearchTree* bstree_successor(const BinarySearchTree* x);
+/** Operator : search for the subtree who is the successor of the given subtree, NULL for the largest key.
+ * The successor is found through the parent links, in O(log n) in the worst case and in amortized constant time
+ * over a full iteration. When the library and all its users are compiled with BSTREE_THREADED (make THREADED=yes),
+ * each node is also linked to its in-order neighbours, kept up to date by the insertions and removals : this is then
+ * a constant time access, for 2 more pointers per node.
+ */
+BSTREE_ACCESSOR const BinarySearchTree* bstree_successor(const BinarySearchTree* x);
 
-/** Operator : search for the subtree who is the predecessor of the given subtree.*/
-const BinarySearchTree* bstree_predecessor(const BinarySearchTree* x);
+/** Operator : search for the subtree who is the predecessor of the given subtree, NULL for the smallest key.
+ * See bstree_successor.
+ */
+BSTREE_ACCESSOR const BinarySearchTree* bstree_predecessor(const BinarySearchTree* x);
 
 /** Operator : remove a value from a BinarySearchTree.
  */
-void bstree_remove(ptrBinarySearchTree* t, int v);
+void bstree_remove(ptrBinarySearchTree* t, BSTreeKey v);
+
+/** @} */
+
+/*------------------------  BSTreeMultiset  -----------------------------*/
+
+/** \defgroup BSTreeMultiset Multiset operators on BinarySearchTree.
+ @{
+ * A BinarySearchTree can be used as a multiset : each node stores the number of occurrences of its key, so
+ * duplicates cost no extra node. The dictionary operators see each key once, bstree_remove removing all its
+ * occurrences.
+ */
+/** Constructor : add an occurrence of a value to the BinarySearchTree.
+ * If v is already in the tree, its number of occurrences is incremented.
+ * @return the number of occurrences of v after the insertion.
+ */
+unsigned int bstree_multiset_add(ptrBinarySearchTree* t, BSTreeKey v);
+
+/** Constructor : add n occurrences of a value to the BinarySearchTree.
+ * @pre n > 0
+ * @return the number of occurrences of v after the insertion.
+ */
+unsigned int bstree_multiset_add_occurrences(ptrBinarySearchTree* t, BSTreeKey v, unsigned int n);
+
+/** Operator : remove an occurrence of a value from the BinarySearchTree.
+ * The node is removed from the tree when its last occurrence is removed.
+ */
+void bstree_multiset_remove(ptrBinarySearchTree* t, BSTreeKey v);
+
+/** Operator : number of occurrences of a value in the BinarySearchTree, 0 if the value is not in the tree.
+ */
+unsigned int bstree_count(const BinarySearchTree* t, BSTreeKey v);
+
+/** Operator : number of occurrences of the key of the root of the tree.
+ * @pre !bstree_empty(t)
+ */
+unsigned int bstree_multiplicity(const BinarySearchTree* t);
 
 /** @} */
 
@@ -135,7 +238,8 @@ void bstree_depth_infix(const BinarySearchTree* t, OperateFunctor f, void* envir
 void bstree_depth_postfix(const BinarySearchTree* t, OperateFunctor f, void* environment);
 
 /** Visitor : infix, depth first visitor.
- * This is the iterative implementation of the visitor.
+ * This is the iterative implementation of the visitor, the ancestors of the current node are kept in an explicit
+ * stack, see BSTreeTraversals to reuse it between visits.
  * @param t the tree to visit.
  * @param f the functor to apply on each node of the tree.
  * @param environment user defined environment to forward to the functor.
@@ -148,14 +252,416 @@ void bstree_iterative_depth_infix(const BinarySearchTree* t, OperateFunctor f, v
 */
 
 /** Visitor : breadth first visitor.
- * This is the iterative implementation of the visitor.
+ * This is the iterative implementation of the visitor, see bstree_breadth_levels.
  * @param t the tree to visit.
  * @param f the functor to apply on each node of the tree.
  * @param environment user defined environment to forward to the functor.
  */
 void bstree_iterative_breadth(const BinarySearchTree* t, OperateFunctor f, void* environment);
+
+/** Functor called at the end of each level of a breadth first visit, with the depth of the level, 0 for the root,
+ * and its number of nodes.
+ */
+typedef void(*LevelFunctor)(int depth, size_t width, void* environment);
+
+/** Visitor : breadth first visitor reporting the end of each level.
+ * The pending nodes are kept in a single array used as a circular queue, which doubles when it is full : the
+ * visit does not allocate per node, its memory is proportional to the largest level. See BSTreeTraversals to
+ * reuse it between visits.
+ * @param t the tree to visit.
+ * @param f the functor to apply on each node of the tree, in level order, may be NULL.
+ * @param level the functor called after the last node of each level, may be NULL.
+ * @param environment user defined environment to forward to the functors.
+ */
+void bstree_breadth_levels(const BinarySearchTree* t, OperateFunctor f, LevelFunctor level, void* environment);
+/** @} */
+
+/** Visitor : infix visit of the nodes whose key is in [low, high].
+ * Only the subtrees that may contain such keys are visited.
+ * @param t the tree to visit.
+ * @param low the lowest key to visit.
+ * @param high the highest key to visit.
+ * @param f the functor to apply on each visited node.
+ * @param environment user defined environment to forward to the functor.
+ */
+void bstree_range(const BinarySearchTree* t, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment);
+
+/** Visitor : differences between two trees, found by merging their infix walks in O(n + m) without allocation.
+ * A key present in both trees with different numbers of occurrences is reported as removed then added.
+ * See bstree_handle_diff for a cost proportional to the number of differences.
+ * @param a the old tree.
+ * @param b the new tree.
+ * @param on_added the functor applied, in increasing order of the keys, to the nodes of b whose key is not in a.
+ * @param on_removed the functor applied to the nodes of a whose key is not in b.
+ * @param environment user defined environment to forward to the functors.
+ */
+void bstree_diff(const BinarySearchTree* a, const BinarySearchTree* b, OperateFunctor on_added, OperateFunctor on_removed, void* environment);
+
+/** \defgroup BSTreeControlledVisitors Visitors whose functor can prune or stop the visit.
+ * @{
+ * These visitors allow "find first" style queries to stop as soon as the answer is known instead of walking
+ * the whole tree. For visitors with an inlined functor, see bstree_visitor.h.
+*/
+
+/** Action returned by a ControlFunctor to drive the visit.
+ * visit_skip prunes the subtrees of the current node that are not yet visited, the rest of the tree is visited as
+ * usual :
+ * - prefix and breadth first visits : both subtrees of the node are pruned.
+ * - infix visit : the left subtree is already visited, only the right one is pruned. The keys greater than the
+ *   node that are outside of its right subtree are still visited : skip does not mean "no greater key".
+ *   Use visit_stop to end the visit at the first node that answers the query.
+ */
+typedef enum {
+    visit_continue, /**< go on with the visit. */
+    visit_skip,     /**< do not visit the subtrees of the current node that are not yet visited. */
+    visit_stop      /**< stop the whole visit. */
+} VisitAction;
+
+/** Functor with user data that tells the visitor how to go on after processing a node.
+ */
+typedef VisitAction(*ControlFunctor)(const BinarySearchTree*, void*);
+
+/** Visitor : prefix, depth first visitor that can be pruned or stopped by its functor.
+ * visit_skip prevents the visit of both subtrees of the node.
+ * @param t the tree to visit.
+ * @param f the functor to apply on each node of the tree.
+ * @param environment user defined environment to forward to the functor.
+ * @return true if the visit was stopped by the functor.
+ */
+bool bstree_depth_prefix_until(const BinarySearchTree* t, ControlFunctor f, void* environment);
+
+/** Visitor : infix, depth first visitor that can be pruned or stopped by its functor.
+ * visit_skip prevents the visit of the right subtree of the node, the left one being already visited. The visit
+ * goes on with the ancestors of the node and their right subtrees.
+ * @param t the tree to visit.
+ * @param f the functor to apply on each node of the tree.
+ * @param environment user defined environment to forward to the functor.
+ * @return true if the visit was stopped by the functor.
+ */
+bool bstree_depth_infix_until(const BinarySearchTree* t, ControlFunctor f, void* environment);
+
+/** Visitor : breadth first visitor that can be pruned or stopped by its functor.
+ * visit_skip prevents the visit of both subtrees of the node.
+ * @param t the tree to visit.
+ * @param f the functor to apply on each node of the tree.
+ * @param environment user defined environment to forward to the functor.
+ * @return true if the visit was stopped by the functor.
+ */
+bool bstree_iterative_breadth_until(const BinarySearchTree* t, ControlFunctor f, void* environment);
+/** @} */
+
+/** \defgroup BSTreeTraversals Iterative visitors with a reusable memory.
+ * @{
+ * The iterative visitors keep their pending nodes in an array which grows by doubling. The visitors above
+ * allocate this array at each call and free it before returning. A BSTreeTraversal owned by the caller keeps it
+ * from one visit to the next : once it has grown to the size needed by the trees visited, the visits do not
+ * allocate anymore. The memory needed is the width of the largest level for a breadth first visit and the height
+ * of the tree for an infix visit.
+ *
+ * A BSTreeTraversal is used by a single visit at a time : it must not be shared between threads, nor used by a
+ * functor called from a visit using it.
+ */
+
+/** Opaque definition of the type BSTreeTraversal */
+typedef struct _BSTreeTraversal BSTreeTraversal;
+typedef BSTreeTraversal* ptrBSTreeTraversal;
+
+/** Constructor : creates a traversal memory able to hold capacity nodes without growing, 0 for a default size.
+ */
+BSTreeTraversal* bstree_traversal_create(size_t capacity);
+
+/** Destructor : frees the traversal memory.
+ */
+void bstree_traversal_delete(ptrBSTreeTraversal* c);
+
+/** Operator : number of nodes the traversal memory can hold without growing.
+ */
+size_t bstree_traversal_capacity(const BSTreeTraversal* c);
+
+/** Visitor : breadth first visitor reporting the end of each level, see bstree_breadth_levels.
+ * @param c the traversal memory, grown if needed.
+ */
+void bstree_traversal_breadth(BSTreeTraversal* c, const BinarySearchTree* t, OperateFunctor f, LevelFunctor level, void* environment);
+
+/** Visitor : breadth first visitor that can be pruned or stopped by its functor, see bstree_iterative_breadth_until.
+ * @param c the traversal memory, grown if needed.
+ */
+bool bstree_traversal_breadth_until(BSTreeTraversal* c, const BinarySearchTree* t, ControlFunctor f, void* environment);
+
+/** Visitor : infix, depth first visitor, see bstree_iterative_depth_infix.
+ * @param c the traversal memory, grown if needed.
+ */
+void bstree_traversal_depth_infix(BSTreeTraversal* c, const BinarySearchTree* t, OperateFunctor f, void* environment);
+/** @} */
+
+/** @} */
+
+/*------------------------  BSTreeHandle  -----------------------------*/
+
+/** \defgroup BSTreeHandle Trees managed with creation options.
+ * @{
+ * A BSTreeHandle owns a BinarySearchTree together with the options chosen at its creation and maintains its
+ * number of nodes. The tree itself is accessed with bstree_handle_root and can be read with all the operators
+ * and visitors on BinarySearchTree, but must only be modified through the handle.
+ */
+
+/** Allocator of the nodes of a tree.
+ * allocate receives the size of a node, see bstree_node_size and bstree_options_node_size, and the user context.
+ */
+typedef struct {
+    void* (*allocate)(size_t size, void* context);
+    void (*release)(void* node, void* context);
+    void* context;
+} BSTreeAllocator;
+
+/** Balancing engine of a managed tree.
+ * All the engines give logarithmic operations, they differ in the trade-off between the height of the tree
+ * (search cost) and the work done to restore the balance (insertion and removal cost).
+ */
+typedef enum {
+    balancing_redblack, /**< red-black tree, the engine of bstree_add and bstree_remove. */
+    balancing_avl,      /**< AVL tree, shallower than red-black trees but with more rotations on updates. */
+    balancing_treap,    /**< treap with priorities derived from the keys, few rotations, expected log height. */
+    balancing_llrb,     /**< left-leaning red-black tree, red links always lean left. */
+    balancing_redblack_topdown /**< red-black tree with single pass, top-down insertion : 4-nodes are split on
+                                    the way down, each node of the path is visited once. */
+} BalancingPolicy;
+
+/** Eviction policy of a bounded managed tree.
+ * When an insertion makes the tree exceed its capacity, nodes are removed according to the policy, with all their
+ * occurrences for a multiset, until the tree fits again.
+ */
+typedef enum {
+    eviction_oldest,  /**< evict the node created first, searches and new occurrences do not change the order. */
+    eviction_lru,     /**< evict the least recently used node : adding an existing value or accessing it with
+                           bstree_handle_access makes it the most recently used. */
+    eviction_smallest /**< evict the node with the smallest key, which may be the node just created. */
+} EvictionPolicy;
+
+/** Monoid summarizing the subtrees of an augmented managed tree.
+ * Each node of an augmented tree carries a value of value_size bytes, zeroed when the node is created and set
+ * with bstree_handle_set_value, and the summary of its subtree, of summary_size bytes. The summary of a subtree is
+ * the combination, in increasing order of the keys, of the summaries of its nodes taken alone. The summaries are
+ * kept up to date by every modification of the tree, rotations included, for O(log n) range aggregates.
+ * combine must be associative, with the summary written by identity as neutral element. The buffers are aligned
+ * for the basic types.
+ */
+typedef struct {
+    /** size of the value of a node, 0 if the summary only depends on the keys. */
+    size_t value_size;
+    /** size of a summary. */
+    size_t summary_size;
+    /** writes the summary of an empty set of nodes. */
+    void (*identity)(void* summary, void* context);
+    /** writes the summary of a single node, having count occurrences of key and the given value. */
+    void (*lift)(void* summary, BSTreeKey key, unsigned int count, const void* value, void* context);
+    /** writes the summary of the nodes summarized by a followed by the nodes summarized by b. result may be the
+     * same buffer as a or b. */
+    void (*combine)(void* result, const void* a, const void* b, void* context);
+    /** user context given to the functions. */
+    void* context;
+} BSTreeAugmentation;
+
+/** Options of a managed tree, chosen at its creation. */
+typedef struct {
+    /** allocator of the nodes, malloc and free by default. */
+    BSTreeAllocator allocator;
+    /** if true, the tree is a multiset : adding a value already in the tree increments its number of
+     * occurrences and removing it decrements this number. */
+    bool multiset;
+    /** balancing engine of the tree, red-black by default. */
+    BalancingPolicy balancing;
+    /** maximum number of nodes of the tree, 0 (the default) for no limit. */
+    size_t max_nodes;
+    /** maximum number of bytes used by the nodes, counting bstree_options_node_size bytes per node, 0 (the
+     * default) for no limit. When both limits are given, the smallest one applies. */
+    size_t max_bytes;
+    /** eviction policy when the tree is bounded, eviction_oldest by default. */
+    EvictionPolicy eviction;
+    /** monoid whose summaries are maintained in the nodes, copied at the creation of the tree. NULL (the default)
+     * for a tree without summaries. */
+    const BSTreeAugmentation* augmentation;
+} BSTreeOptions;
+
+/** Opaque definition of the type BSTreeHandle */
+typedef struct _bstree_handle BSTreeHandle;
+typedef BSTreeHandle* ptrBSTreeHandle;
+
+/** Size in bytes of the nodes of a tree, i.e. the size requested to BSTreeAllocator::allocate.
+ * This is also the size of the nodes of a managed tree, unless it is augmented or bounded with an eviction policy
+ * based on the age of the nodes, see bstree_options_node_size.
+ */
+size_t bstree_node_size(void);
+
+/** Size in bytes of the nodes of a managed tree created with the given options, i.e. the size requested to
+ * BSTreeAllocator::allocate. The data that only some trees use are stored after the node, in the same allocation :
+ * the recency list of the eviction_oldest and eviction_lru policies of a bounded tree, then the value and the
+ * summary of an augmented tree.
+ */
+size_t bstree_options_node_size(const BSTreeOptions* options);
+
+/** Constructor : fills the options with default values.
+ */
+void bstree_default_options(BSTreeOptions* options);
+
+/** Constructor : builds an empty managed tree.
+ * @param options the options of the tree, NULL for the default options.
+ */
+BSTreeHandle* bstree_handle_create(const BSTreeOptions* options);
+
+/** Destructor : delete the managed tree and its nodes.
+ */
+void bstree_handle_delete(ptrBSTreeHandle* h);
+
+/** Operator : the tree managed by the handle.
+ */
+const BinarySearchTree* bstree_handle_root(const BSTreeHandle* h);
+
+/** Operator : number of nodes of the managed tree.
+ */
+size_t bstree_handle_size(const BSTreeHandle* h);
+
+/** Constructor : add a value to the managed tree.
+ * If the tree is bounded and the new node exceeds its capacity, nodes are evicted according to the policy.
+ * @return true if a new node was created.
+ */
+bool bstree_handle_add(BSTreeHandle* h, BSTreeKey v);
+
+/** Operator : remove a value, or one of its occurrences for a multiset, from the managed tree.
+ * @return true if the value was in the tree.
+ */
+bool bstree_handle_remove(BSTreeHandle* h, BSTreeKey v);
+
+/** Constructor : add n occurrences of a value to the managed tree.
+ * If the tree is not a multiset, this is the same as bstree_handle_add.
+ * @pre n > 0
+ */
+void bstree_handle_add_occurrences(BSTreeHandle* h, BSTreeKey v, unsigned int n);
+
+/** Operator : remove a value and all its occurrences from the managed tree.
+ * @return the number of occurrences removed, 0 if the value was not in the tree.
+ */
+unsigned int bstree_handle_remove_all(BSTreeHandle* h, BSTreeKey v);
+
+/** Operator : search for the subtree having a given value as root.
+ * The search does not count as a use of the node for the eviction_lru policy, see bstree_handle_access.
+ */
+const BinarySearchTree* bstree_handle_search(const BSTreeHandle* h, BSTreeKey v);
+
+/** Operator : search for the subtree having a given value as root and mark it as the most recently used node
+ * when the eviction policy is eviction_lru.
+ */
+const BinarySearchTree* bstree_handle_access(BSTreeHandle* h, BSTreeKey v);
+
+/** Operator : maximum number of nodes of the managed tree, 0 if it is not bounded.
+ */
+size_t bstree_handle_capacity(const BSTreeHandle* h);
+
+/** Operator : number of nodes evicted from the managed tree since its creation.
+ */
+size_t bstree_handle_evictions(const BSTreeHandle* h);
+
 /** @} */
 
+/*------------------------  BSTreeAugmented  -----------------------------*/
+
+/** \defgroup BSTreeAugmented Managed trees augmented with subtree summaries.
+ * @{
+ * A managed tree created with a BSTreeAugmentation in its options stores in each node the summary of its subtree.
+ * Three monoids are provided : the sums of the keys, a hash of the content to compare trees, and the maximum high
+ * end of intervals for interval trees, where a node of key low with the value high holds the interval [low, high].
+ * The functions of this group require an augmented tree.
+ */
+
+/** Summary of bstree_sum_augmentation. */
+typedef struct {
+    /** number of occurrences of the keys. */
+    unsigned long long occurrences;
+    /** sum of the keys, each one counted as many times as it occurs. With 64 bits keys, the keys summed must be
+     * small enough for the sum not to overflow. */
+    long long sum;
+} BSTreeSum;
+
+/** Constructor : fills the monoid counting the occurrences and summing the keys, whose summary is a BSTreeSum.
+ */
+void bstree_sum_augmentation(BSTreeAugmentation* augmentation);
+
+/** Summary of bstree_hash_augmentation. */
+typedef struct {
+    /** sum of a 64 bits hash of the key and the number of occurrences of each node. */
+    unsigned long long hash;
+    /** number of nodes. */
+    unsigned long long nodes;
+} BSTreeHash;
+
+/** Constructor : fills the monoid hashing the content of the subtrees, whose summary is a BSTreeHash.
+ * The hash of a range of keys only depends on the keys and their occurrences, not on the shape of the trees :
+ * two trees with the same content have the same hashes, whatever their balancing engines and histories.
+ * The hash detects accidental differences, it does not resist keys chosen to collide.
+ */
+void bstree_hash_augmentation(BSTreeAugmentation* augmentation);
+
+/** Constructor : fills the monoid of the interval trees. The value of a node is a BSTreeKey, the high end of the
+ * interval starting at its key, and its summary the largest high end of its subtree, a BSTreeKey.
+ */
+void bstree_interval_augmentation(BSTreeAugmentation* augmentation);
+
+/** Operator : sets the value of the node of key v and updates the summaries, in O(log n).
+ * @param value value_size bytes copied in the node.
+ * @return false if v is not in the tree.
+ */
+bool bstree_handle_set_value(BSTreeHandle* h, BSTreeKey v, const void* value);
+
+/** Operator : the value of a node of the augmented tree managed by h.
+ * The nodes do not know the monoid of their tree, the value and the summary are found through the handle.
+ */
+const void* bstree_augmented_value(const BSTreeHandle* h, const BinarySearchTree* t);
+
+/** Operator : the value of a node of the managed tree, to be modified in place without copying it.
+ * If the modification changes the summary of the node, bstree_handle_value_changed must be called after it.
+ * @pre t is a node of the tree managed by h.
+ */
+void* bstree_handle_value(BSTreeHandle* h, const BinarySearchTree* t);
+
+/** Operator : updates the summaries after an in place modification of the value of t, in O(log n).
+ * @pre t is a node of the tree managed by h.
+ */
+void bstree_handle_value_changed(BSTreeHandle* h, const BinarySearchTree* t);
+
+/** Operator : the summary of the subtree t of the augmented tree managed by h.
+ */
+const void* bstree_augmented_summary(const BSTreeHandle* h, const BinarySearchTree* t);
+
+/** Operator : writes in result the summary of the nodes whose keys are between low and high, bounds included, in
+ * O(log n). result receives the identity if there is no such node.
+ * The query uses a buffer of the handle : it must not run concurrently with other operations on the same handle.
+ */
+void bstree_handle_aggregate(const BSTreeHandle* h, BSTreeKey low, BSTreeKey high, void* result);
+
+/** Visitor : same as bstree_diff on two trees augmented with bstree_hash_augmentation.
+ * The ranges of keys having the same hash in both trees are skipped without being visited : the cost is
+ * O(d log(n) log(range)) for d differences instead of O(n + m). Differences are reported in increasing order.
+ * The query uses the buffers of both handles, see bstree_handle_aggregate.
+ */
+void bstree_handle_diff(const BSTreeHandle* a, const BSTreeHandle* b, OperateFunctor on_added, OperateFunctor on_removed, void* environment);
+
+/** Constructor : adds the interval [low, high] to an interval tree, replacing the interval starting at low if any.
+ * @pre the tree is augmented with bstree_interval_augmentation.
+ * @return false if the new node was evicted from a bounded tree.
+ */
+bool bstree_handle_add_interval(BSTreeHandle* h, BSTreeKey low, BSTreeKey high);
+
+/** Operator : an interval of the tree overlapping [low, high], NULL if there is none, in O(log n).
+ * @pre the tree is augmented with bstree_interval_augmentation.
+ */
+const BinarySearchTree* bstree_handle_overlap(const BSTreeHandle* h, BSTreeKey low, BSTreeKey high);
+
+/** Operator : applies f to all the intervals of the tree overlapping [low, high], in increasing order of their
+ * low ends. The subtrees without overlapping interval are skipped.
+ * @pre the tree is augmented with bstree_interval_augmentation.
+ */
+void bstree_handle_overlaps(const BSTreeHandle* h, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment);
+
 /** @} */
 
 /*------------------------  BSTreeIterator  -----------------------------*/
@@ -185,6 +691,11 @@ typedef BSTreeIterator* ptrBSTreeIterator;
  */
 BSTreeIterator* bstree_iterator_create(const BinarySearchTree* c, IteratorDirection d);
 
+/** Constructor : builds an iterator on the multiset c, going in the direction d.
+ * Each node is visited as many times as its key occurs in the multiset.
+ */
+BSTreeIterator* bstree_multiset_iterator_create(const BinarySearchTree* c, IteratorDirection d);
+
 /**
  * Destructor : delete the iterator
  */
@@ -227,10 +738,27 @@ void testrotateleft(BinarySearchTree* t);
  */
 void testrotateright(BinarySearchTree* t);
 
+/**
+ * Checks the structure of the tree : increasing keys, parent links, in-order links if any, occurrence counts, and the
+ * red-black properties. Linear in the size of the tree, meant for the tests.
+ * @return NULL if the tree is valid, a static message describing the first violation found otherwise.
+ */
+const char* bstree_check(const BinarySearchTree* t);
+
+/**
+ * Same as bstree_check for a managed tree, with the invariants of its balancing engine, its size, its capacity,
+ * its recency list and its summaries, compared byte per byte with the summaries computed again.
+ */
+const char* bstree_handle_check(const BSTreeHandle* h);
+
 
 /** @} */
 
 void bstree_node_to_dot(const BinarySearchTree* t, void* stream);
 
 BinarySearchTree* fixredblack_insert(BinarySearchTree* x);
+
+#ifdef BSTREE_INLINE_ACCESSORS
+#include "bstree_node.h"
+#endif
 #endif
@@ -0,0 +1,109 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Node layout and accessors of the BinarySearchTree.
+ This file is internal to the implementation : it is included by bstree.c, and by bstree.h only when
+ BSTREE_INLINE_ACCESSORS is defined. User code must not rely on the content of struct _bstree.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __BSTREE_NODE__H__
+#define __BSTREE_NODE__H__
+#include <assert.h>
+#include "bstree.h"
+
+/*------------------------  BSTreeType  -----------------------------*/
+typedef enum {red, black} NodeColor;
+
+struct _bstree {
+    BinarySearchTree* parent;
+    BinarySearchTree* left;
+    BinarySearchTree* right;
+    NodeColor color;
+    /* balancing information of the engines that do not use the color : height for AVL, priority for treap */
+    int rank;
+    BSTreeKey key;
+    /* number of occurrences of the key, always 1 unless the tree is used as a multiset */
+    unsigned int count;
+#ifdef BSTREE_THREADED
+    /* in-order neighbours of the node, NULL at the ends : successor and predecessor in one memory access */
+    BinarySearchTree* prev;
+    BinarySearchTree* next;
+#endif
+};
+
+/*------------------------  BaseBSTree  -----------------------------*/
+/* With BSTREE_INLINE_ACCESSORS, these are C99 inline definitions that every user of bstree.h can inline, the
+ * external definitions being emitted once by bstree.c. Otherwise they are the plain definitions of bstree.c.
+ */
+
+BSTREE_ACCESSOR bool bstree_empty(const BinarySearchTree* t) {
+    return t == NULL;
+}
+
+BSTREE_ACCESSOR BSTreeKey bstree_key(const BinarySearchTree* t) {
+    assert(!bstree_empty(t));
+    return t->key;
+}
+
+BSTREE_ACCESSOR BinarySearchTree* bstree_left(const BinarySearchTree* t) {
+    assert(!bstree_empty(t));
+    return t->left;
+}
+
+BSTREE_ACCESSOR BinarySearchTree* bstree_right(const BinarySearchTree* t) {
+    assert(!bstree_empty(t));
+    return t->right;
+}
+
+BSTREE_ACCESSOR BinarySearchTree* bstree_parent(const BinarySearchTree* t) {
+    assert(!bstree_empty(t));
+    return t->parent;
+}
+
+#ifdef BSTREE_THREADED
+BSTREE_ACCESSOR const BinarySearchTree* bstree_successor(const BinarySearchTree* x) {
+    assert(!bstree_empty(x));
+    return x->next;
+}
+
+BSTREE_ACCESSOR const BinarySearchTree* bstree_predecessor(const BinarySearchTree* x) {
+    assert(!bstree_empty(x));
+    return x->prev;
+}
+#else
+/* Without the in-order links, the successor is the minimum of the right subtree if there is one, the first ancestor
+ * whose left subtree holds x otherwise. Each edge is crossed twice during a full iteration.
+ */
+BSTREE_ACCESSOR const BinarySearchTree* bstree_successor(const BinarySearchTree* x) {
+    assert(!bstree_empty(x));
+    if(!bstree_empty(x->right)){
+        x = x->right;
+        while(!bstree_empty(x->left)){
+            x = x->left;
+        }
+        return x;
+    }
+    while(!bstree_empty(x->parent) && x->parent->right == x){
+        x = x->parent;
+    }
+    return x->parent;
+}
+
+BSTREE_ACCESSOR const BinarySearchTree* bstree_predecessor(const BinarySearchTree* x) {
+    assert(!bstree_empty(x));
+    if(!bstree_empty(x->left)){
+        x = x->left;
+        while(!bstree_empty(x->right)){
+            x = x->right;
+        }
+        return x;
+    }
+    while(!bstree_empty(x->parent) && x->parent->left == x){
+        x = x->parent;
+    }
+    return x->parent;
+}
+#endif
+
+#endif
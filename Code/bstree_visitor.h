@@ -0,0 +1,84 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Generation of specialized visitors on BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __BSTREE_VISITOR__H__
+#define __BSTREE_VISITOR__H__
+#include "bstree.h"
+
+/** \defgroup BSTreeInlinedVisitors Visitors specialized at compile time for a given operation.
+ * @{
+ * The visitors of bstree.h call their functor through a pointer for every node, which prevents the compiler
+ * from inlining the operation. The macros below generate a static visitor dedicated to one operation, given as
+ * the name of a function (or of a function-like macro) with the same signature as OperateFunctor or
+ * ControlFunctor. The operation is then called directly and can be inlined.
+ *
+ * Example :
+ * @code
+ * static inline VisitAction find_greater(const BinarySearchTree* t, void* env) { ... }
+ * BSTREE_DEFINE_DEPTH_INFIX_UNTIL(visit_find_greater, find_greater)
+ * ...
+ * visit_find_greater(tree, &env);
+ * @endcode
+ */
+
+/** Defines name(t, environment) as an infix, depth first visitor applying operation on each node.
+ */
+#define BSTREE_DEFINE_DEPTH_INFIX(name, operation)                                  \
+static void name(const BinarySearchTree* t, void* environment) {                    \
+    while (!bstree_empty(t)) {                                                      \
+        name(bstree_left(t), environment);                                          \
+        operation(t, environment);                                                  \
+        t = bstree_right(t);                                                        \
+    }                                                                               \
+}
+
+/** Defines name(t, environment) as a prefix, depth first visitor applying operation on each node.
+ */
+#define BSTREE_DEFINE_DEPTH_PREFIX(name, operation)                                 \
+static void name(const BinarySearchTree* t, void* environment) {                    \
+    while (!bstree_empty(t)) {                                                      \
+        operation(t, environment);                                                  \
+        name(bstree_left(t), environment);                                          \
+        t = bstree_right(t);                                                        \
+    }                                                                               \
+}
+
+/** Defines bool name(t, environment) as an infix, depth first visitor driven by operation, which returns a
+ * VisitAction. Same semantic as bstree_depth_infix_until : visit_skip only prunes the right subtree of the node.
+ */
+#define BSTREE_DEFINE_DEPTH_INFIX_UNTIL(name, operation)                            \
+static bool name(const BinarySearchTree* t, void* environment) {                    \
+    while (!bstree_empty(t)) {                                                      \
+        if (name(bstree_left(t), environment))                                      \
+            return true;                                                            \
+        VisitAction action = operation(t, environment);                             \
+        if (action != visit_continue)                                               \
+            return action == visit_stop;                                            \
+        t = bstree_right(t);                                                        \
+    }                                                                               \
+    return false;                                                                   \
+}
+
+/** Defines bool name(t, environment) as a prefix, depth first visitor driven by operation, which returns a
+ * VisitAction. Same semantic as bstree_depth_prefix_until : visit_skip prunes both subtrees of the node.
+ */
+#define BSTREE_DEFINE_DEPTH_PREFIX_UNTIL(name, operation)                           \
+static bool name(const BinarySearchTree* t, void* environment) {                    \
+    while (!bstree_empty(t)) {                                                      \
+        VisitAction action = operation(t, environment);                             \
+        if (action != visit_continue)                                               \
+            return action == visit_stop;                                            \
+        if (name(bstree_left(t), environment))                                      \
+            return true;                                                            \
+        t = bstree_right(t);                                                        \
+    }                                                                               \
+    return false;                                                                   \
+}
+
+/** @} */
+
+#endif
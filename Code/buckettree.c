@@ -0,0 +1,256 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Hybrid tree : a BinarySearchTree indexing sorted arrays of keys.
+ */
+/*-----------------------------------------------------------------*/
+#include "buckettree.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+/* SSE2 only compares 32 bits integers : 64 bits keys are compared one by one */
+#if defined(__SSE2__) && !defined(BSTREE_KEY64)
+#define BUCKET_SSE2
+#include <emmintrin.h>
+#endif
+
+/* A bucket whose size falls below this bound is merged with a neighbour */
+#define BUCKET_MIN (BUCKET_CAPACITY / 4)
+/* Two buckets are merged only if the result leaves room for new keys */
+#define BUCKET_MERGE (BUCKET_CAPACITY * 3 / 4)
+
+/* The value of a node of the index. The unused slots hold BSTREE_KEY_MAX, so that the search always compares the whole
+ * array, with no dependency on the size. */
+typedef struct {
+    int size;
+    BSTreeKey keys[BUCKET_CAPACITY];
+} Bucket;
+
+struct s_buckettree {
+    /* red-black tree of the lower bounds of the buckets, the first one being BSTREE_KEY_MIN */
+    BSTreeHandle* index;
+    /* number of keys in all the buckets */
+    size_t size;
+};
+
+/* The index only stores the buckets : the summaries are empty */
+static void empty_identity(void* summary, void* context) {
+    (void)summary;
+    (void)context;
+}
+
+static void empty_lift(void* summary, BSTreeKey key, unsigned int count, const void* value, void* context) {
+    (void)summary;
+    (void)key;
+    (void)count;
+    (void)value;
+    (void)context;
+}
+
+static void empty_combine(void* result, const void* a, const void* b, void* context) {
+    (void)result;
+    (void)a;
+    (void)b;
+    (void)context;
+}
+
+BucketTree* buckettree_create(void) {
+    BucketTree* bt = malloc(sizeof(BucketTree));
+    BSTreeAugmentation buckets = { sizeof(Bucket), 0, empty_identity, empty_lift, empty_combine, NULL };
+    BSTreeOptions options;
+    bstree_default_options(&options);
+    options.augmentation = &buckets;
+    bt->index = bstree_handle_create(&options);
+    bt->size = 0;
+    return bt;
+}
+
+void buckettree_delete(ptrBucketTree* bt) {
+    bstree_handle_delete(&(*bt)->index);
+    free(*bt);
+    *bt = NULL;
+}
+
+/* Number of keys of the bucket smaller than v, i.e. the position of v in the bucket */
+static int bucket_lower(const Bucket* b, BSTreeKey v) {
+#ifdef BUCKET_SSE2
+    __m128i value = _mm_set1_epi32(v);
+    __m128i count = _mm_setzero_si128();
+    for (int i = 0; i < BUCKET_CAPACITY; i += 4) {
+        /* the lanes where the key is smaller are -1 */
+        __m128i keys = _mm_loadu_si128((const __m128i*)&b->keys[i]);
+        count = _mm_sub_epi32(count, _mm_cmplt_epi32(keys, value));
+    }
+    count = _mm_add_epi32(count, _mm_shuffle_epi32(count, _MM_SHUFFLE(1, 0, 3, 2)));
+    count = _mm_add_epi32(count, _mm_shuffle_epi32(count, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(count);
+#else
+    int position = 0;
+    for (int i = 0; i < BUCKET_CAPACITY; ++i)
+        position += b->keys[i] < v;
+    return position;
+#endif
+}
+
+static void bucket_clear(Bucket* b) {
+    b->size = 0;
+    for (int i = 0; i < BUCKET_CAPACITY; ++i)
+        b->keys[i] = BSTREE_KEY_MAX;
+}
+
+/* Node of the index whose bucket may contain v : the one with the greatest lower bound not above v */
+static const BinarySearchTree* find_bucket(const BucketTree* bt, BSTreeKey v) {
+    const BinarySearchTree* t = bstree_handle_root(bt->index);
+    const BinarySearchTree* found = NULL;
+    while (!bstree_empty(t)) {
+        if (bstree_key(t) <= v) {
+            found = t;
+            t = bstree_right(t);
+        }
+        else
+            t = bstree_left(t);
+    }
+    return found;
+}
+
+static const Bucket* bucket_of(const BucketTree* bt, const BinarySearchTree* node) {
+    return bstree_augmented_value(bt->index, node);
+}
+
+/* Adds a node for the keys from lower on and returns its empty bucket */
+static Bucket* new_bucket(BucketTree* bt, BSTreeKey lower) {
+    bstree_handle_add(bt->index, lower);
+    Bucket* b = bstree_handle_value(bt->index, bstree_handle_search(bt->index, lower));
+    bucket_clear(b);
+    return b;
+}
+
+/* Moves the keys of the bucket of next at the end of the bucket of node, then removes next */
+static void merge_buckets(BucketTree* bt, const BinarySearchTree* node, const BinarySearchTree* next) {
+    Bucket* b = bstree_handle_value(bt->index, node);
+    const Bucket* n = bucket_of(bt, next);
+    memcpy(&b->keys[b->size], n->keys, n->size * sizeof(BSTreeKey));
+    b->size += n->size;
+    bstree_handle_remove(bt->index, bstree_key(next));
+}
+
+bool buckettree_add(BucketTree* bt, BSTreeKey v) {
+    if (bstree_empty(bstree_handle_root(bt->index)))
+        new_bucket(bt, BSTREE_KEY_MIN);
+    const BinarySearchTree* node = find_bucket(bt, v);
+    Bucket* b = bstree_handle_value(bt->index, node);
+    int i = bucket_lower(b, v);
+    if (i < b->size && b->keys[i] == v)
+        return false;
+
+    if (b->size == BUCKET_CAPACITY) {
+        /* the upper half goes to a new bucket, whose lower bound is its smallest key */
+        int half = BUCKET_CAPACITY / 2;
+        Bucket* upper = new_bucket(bt, b->keys[half]);
+        memcpy(upper->keys, &b->keys[half], (BUCKET_CAPACITY - half) * sizeof(BSTreeKey));
+        upper->size = BUCKET_CAPACITY - half;
+        for (int k = half; k < BUCKET_CAPACITY; ++k)
+            b->keys[k] = BSTREE_KEY_MAX;
+        b->size = half;
+        if (i > half) {
+            b = upper;
+            i -= half;
+        }
+    }
+    memmove(&b->keys[i + 1], &b->keys[i], (b->size - i) * sizeof(BSTreeKey));
+    b->keys[i] = v;
+    ++b->size;
+    ++bt->size;
+    return true;
+}
+
+bool buckettree_remove(BucketTree* bt, BSTreeKey v) {
+    const BinarySearchTree* node = find_bucket(bt, v);
+    if (bstree_empty(node))
+        return false;
+    Bucket* b = bstree_handle_value(bt->index, node);
+    int i = bucket_lower(b, v);
+    if (i == b->size || b->keys[i] != v)
+        return false;
+    memmove(&b->keys[i], &b->keys[i + 1], (b->size - i - 1) * sizeof(BSTreeKey));
+    b->keys[--b->size] = BSTREE_KEY_MAX;
+    --bt->size;
+
+    if (b->size >= BUCKET_MIN)
+        return true;
+    /* the first bucket is never removed : its lower bound BSTREE_KEY_MIN covers all the keys */
+    const BinarySearchTree* next = bstree_successor(node);
+    const BinarySearchTree* previous = bstree_predecessor(node);
+    if (!bstree_empty(next) && b->size + bucket_of(bt, next)->size <= BUCKET_MERGE)
+        merge_buckets(bt, node, next);
+    else if (!bstree_empty(previous) && (b->size == 0 || bucket_of(bt, previous)->size + b->size <= BUCKET_MERGE))
+        merge_buckets(bt, previous, node);
+    return true;
+}
+
+bool buckettree_contains(const BucketTree* bt, BSTreeKey v) {
+    const BinarySearchTree* node = find_bucket(bt, v);
+    if (bstree_empty(node))
+        return false;
+    const Bucket* b = bucket_of(bt, node);
+    int i = bucket_lower(b, v);
+    return i < b->size && b->keys[i] == v;
+}
+
+size_t buckettree_size(const BucketTree* bt) {
+    return bt->size;
+}
+
+size_t buckettree_buckets(const BucketTree* bt) {
+    return bstree_handle_size(bt->index);
+}
+
+void buckettree_visit(const BucketTree* bt, KeyFunctor f, void* environment) {
+    buckettree_range(bt, BSTREE_KEY_MIN, BSTREE_KEY_MAX, f, environment);
+}
+
+void buckettree_range(const BucketTree* bt, BSTreeKey low, BSTreeKey high, KeyFunctor f, void* environment) {
+    const BinarySearchTree* node = find_bucket(bt, low);
+    if (bstree_empty(node))
+        return;
+    /* the buckets follow each other through the successors in the index */
+    for (int i = bucket_lower(bucket_of(bt, node), low); !bstree_empty(node); node = bstree_successor(node), i = 0) {
+        const Bucket* b = bucket_of(bt, node);
+        for (; i < b->size; ++i) {
+            if (b->keys[i] > high)
+                return;
+            f(b->keys[i], environment);
+        }
+    }
+}
+
+const char* buckettree_check(const BucketTree* bt) {
+    const char* error = bstree_handle_check(bt->index);
+    if (error)
+        return error;
+    const BinarySearchTree* node = find_bucket(bt, BSTREE_KEY_MIN);
+    if (bstree_empty(node))
+        return bt->size == 0 ? NULL : "wrong size";
+    if (bstree_key(node) != BSTREE_KEY_MIN)
+        return "first bucket not starting at BSTREE_KEY_MIN";
+    size_t size = 0;
+    for (; !bstree_empty(node); node = bstree_successor(node)) {
+        const Bucket* b = bucket_of(bt, node);
+        const BinarySearchTree* next = bstree_successor(node);
+        if (b->size < 0 || b->size > BUCKET_CAPACITY)
+            return "wrong bucket size";
+        for (int i = 0; i < b->size; ++i) {
+            if (b->keys[i] < bstree_key(node) || (!bstree_empty(next) && b->keys[i] >= bstree_key(next)))
+                return "key out of the bounds of its bucket";
+            if (i > 0 && b->keys[i - 1] >= b->keys[i])
+                return "keys of a bucket not in increasing order";
+        }
+        for (int i = b->size; i < BUCKET_CAPACITY; ++i) {
+            if (b->keys[i] != BSTREE_KEY_MAX)
+                return "unused slot not cleared";
+        }
+        size += b->size;
+    }
+    return size == bt->size ? NULL : "wrong size";
+}
@@ -0,0 +1,83 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Hybrid tree : a BinarySearchTree indexing sorted arrays of keys.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __BUCKETTREE__H__
+#define __BUCKETTREE__H__
+#include "bstree.h"
+
+/** \defgroup BucketTree Hybrid trees with sorted leaf buckets.
+ * @{
+ * A BucketTree stores a set of keys in buckets, sorted arrays of at most BUCKET_CAPACITY keys, indexed by a
+ * red-black tree. Each node of the index holds one bucket, as the value of an augmented managed tree, and its key
+ * is the lower bound of the keys of the bucket. The keys of the bucket are smaller than the lower bound of the next
+ * node.
+ *
+ * The index only has one node for 32 to 64 keys : there are fewer allocations and fewer cache misses than with
+ * one node per key, and the bucket is searched with vector compares (SSE2 when available, for 32 bits keys). A
+ * full bucket is split in two when a key is added, a bucket whose size falls below a quarter of the capacity is
+ * merged with a neighbour.
+ */
+
+/** Maximum number of keys of a bucket. */
+#define BUCKET_CAPACITY 64
+
+/** Functor applied to the keys visited in a BucketTree. */
+typedef void(*KeyFunctor)(BSTreeKey key, void* environment);
+
+/** Opaque definition of the type BucketTree */
+typedef struct s_buckettree BucketTree;
+typedef BucketTree* ptrBucketTree;
+
+/** Constructor : builds an empty bucket tree.
+ */
+BucketTree* buckettree_create(void);
+
+/** Destructor : delete the bucket tree.
+ */
+void buckettree_delete(ptrBucketTree* bt);
+
+/** Constructor : add a value to the tree.
+ * @return true if the value was not yet in the tree.
+ */
+bool buckettree_add(BucketTree* bt, BSTreeKey v);
+
+/** Operator : remove a value from the tree.
+ * @return true if the value was in the tree.
+ */
+bool buckettree_remove(BucketTree* bt, BSTreeKey v);
+
+/** Operator : true if v is in the tree.
+ */
+bool buckettree_contains(const BucketTree* bt, BSTreeKey v);
+
+/** Operator : number of keys in the tree.
+ */
+size_t buckettree_size(const BucketTree* bt);
+
+/** Operator : number of buckets, i.e. of nodes of the index.
+ */
+size_t buckettree_buckets(const BucketTree* bt);
+
+/** Visitor : visit of all the keys of the tree, in increasing order.
+ * The functor must not modify the tree.
+ */
+void buckettree_visit(const BucketTree* bt, KeyFunctor f, void* environment);
+
+/** Visitor : visit of the keys in [low, high], in increasing order.
+ * The functor must not modify the tree.
+ */
+void buckettree_range(const BucketTree* bt, BSTreeKey low, BSTreeKey high, KeyFunctor f, void* environment);
+
+/** Checks the invariants of the tree : the index, the order of the keys in and between the buckets, the bounds of
+ * the buckets and the size.
+ * @return NULL if the tree is valid, the description of the first violation found otherwise.
+ */
+const char* buckettree_check(const BucketTree* bt);
+
+/** @} */
+
+#endif
@@ -0,0 +1,1703 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Differential fuzzer of the BinarySearchTree implementation.
+ Random sequences of operations are applied both to a tree and to a sorted array, the results are compared and
+ the invariants of the tree are checked after each step.
+ */
+/*-----------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include "bstree.h"
+#include "bstree_visitor.h"
+#include "buckettree.h"
+#include "ingest.h"
+#include "nodepool.h"
+#include "queryexecutor.h"
+#include "shardedtree.h"
+#include "wal.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*------------------------  Tools  -----------------------------*/
+
+typedef struct {
+    unsigned long long seed;
+    long steps;
+    int keys;
+    long check_every;
+    const char* subject;
+    long large;
+    int threads;
+} FuzzOptions;
+
+/** Current time in seconds, from a monotonic clock. */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** Pseudo random generator (xorshift64*), the runs only depend on the seed. */
+static unsigned long long next_random(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static int random_below(unsigned long long* state, int n) {
+    return (int)(next_random(state) >> 33) % n;
+}
+
+/* Context of the failures : the failing run can be replayed with the same seed */
+static const char* current_subject;
+static unsigned long long current_seed;
+static long current_step;
+
+static void fail(const char* operation, BSTreeKey key, const char* message) {
+    fprintf(stderr, "FAILURE : subject %s, seed %llu, step %ld, %s %" BSTREE_KEY_FORMAT " : %s\n", current_subject, current_seed,
+            current_step, operation, key, message);
+    exit(1);
+}
+
+/*------------------------  Reference  -----------------------------*/
+
+/** The reference implementation : sorted array of the keys with their number of occurrences. */
+typedef struct {
+    BSTreeKey* keys;
+    unsigned int* counts;
+    size_t size;
+    size_t capacity;
+} Reference;
+
+static void reference_init(Reference* r) {
+    r->capacity = 16;
+    r->size = 0;
+    r->keys = malloc(r->capacity * sizeof(BSTreeKey));
+    r->counts = malloc(r->capacity * sizeof(unsigned int));
+}
+
+static void reference_free(Reference* r) {
+    free(r->keys);
+    free(r->counts);
+}
+
+/* Index of the first key >= v */
+static size_t reference_lower(const Reference* r, BSTreeKey v) {
+    size_t low = 0, high = r->size;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (r->keys[middle] < v)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+static unsigned int reference_count(const Reference* r, BSTreeKey v) {
+    size_t i = reference_lower(r, v);
+    return i < r->size && r->keys[i] == v ? r->counts[i] : 0;
+}
+
+/* Adds n occurrences of v, only one if the reference is a set. Returns true if v was not present. */
+static bool reference_add(Reference* r, BSTreeKey v, unsigned int n, bool multiset) {
+    size_t i = reference_lower(r, v);
+    if (i < r->size && r->keys[i] == v) {
+        if (multiset)
+            r->counts[i] += n;
+        return false;
+    }
+    if (r->size == r->capacity) {
+        r->capacity *= 2;
+        r->keys = realloc(r->keys, r->capacity * sizeof(BSTreeKey));
+        r->counts = realloc(r->counts, r->capacity * sizeof(unsigned int));
+    }
+    memmove(&r->keys[i + 1], &r->keys[i], (r->size - i) * sizeof(BSTreeKey));
+    memmove(&r->counts[i + 1], &r->counts[i], (r->size - i) * sizeof(unsigned int));
+    r->keys[i] = v;
+    r->counts[i] = multiset ? n : 1;
+    ++r->size;
+    return true;
+}
+
+/* Removes one occurrence of v, or all of them. Returns the number of occurrences removed. */
+static unsigned int reference_remove(Reference* r, BSTreeKey v, bool all) {
+    size_t i = reference_lower(r, v);
+    if (i == r->size || r->keys[i] != v)
+        return 0;
+    if (!all && r->counts[i] > 1) {
+        --r->counts[i];
+        return 1;
+    }
+    unsigned int count = r->counts[i];
+    memmove(&r->keys[i], &r->keys[i + 1], (r->size - i - 1) * sizeof(BSTreeKey));
+    memmove(&r->counts[i], &r->counts[i + 1], (r->size - i - 1) * sizeof(unsigned int));
+    --r->size;
+    return count;
+}
+
+/*------------------------  Subjects  -----------------------------*/
+
+/** A tree under test, behind a common interface. */
+typedef struct {
+    const char* name;
+    bool multiset;
+    /* true if the managed tree is augmented with bstree_sum_augmentation */
+    bool summed;
+    /* capacity of a bounded managed tree, 0 if it is not bounded, and its eviction policy */
+    size_t capacity;
+    EvictionPolicy eviction;
+    /* the implementation : a plain tree, a managed tree, a sharded tree or a bucket tree */
+    BinarySearchTree* tree;
+    BSTreeHandle* handle;
+    NodePool* pool;
+    ShardedTree* sharded;
+    BucketTree* buckets;
+    /* reused by all the iterative visits of the tree */
+    BSTreeTraversal* traversal;
+    /* runs the batched queries, with few queries in flight so that they are often replaced */
+    QueryExecutor* executor;
+} Subject;
+
+static const struct {
+    const char* name;
+    BalancingPolicy balancing;
+} engines[] = {
+    { "redblack", balancing_redblack },
+    { "avl", balancing_avl },
+    { "treap", balancing_treap },
+    { "llrb", balancing_llrb },
+    { "topdown", balancing_redblack_topdown },
+};
+
+static const int nbEngines = sizeof(engines) / sizeof(engines[0]);
+
+static const struct {
+    const char* name;
+    EvictionPolicy eviction;
+} policies[] = {
+    { "-oldest", eviction_oldest },
+    { "-lru", eviction_lru },
+    { "-smallest", eviction_smallest },
+};
+
+static const int nbPolicies = sizeof(policies) / sizeof(policies[0]);
+
+/* Capacity of the bounded subjects, a tenth of the default range of keys : most insertions evict a node */
+#define BOUNDED_CAPACITY 100
+
+/* Names of the subjects : "plain", "multiset", "sharded", "bucket" and, for each engine, "<engine>" for a set using
+ * malloc, "<engine>-multiset" for a multiset using a node pool and "<engine>-sum" for a multiset augmented with
+ * the sums of the keys, using a node pool in huge pages. "<engine>-<policy>" and its variants are bounded to
+ * BOUNDED_CAPACITY nodes with an eviction policy, each policy is run as a set, a multiset and an augmented multiset
+ * with different engines. */
+static const char* const subjects[] = {
+    "plain", "multiset",
+    "redblack", "redblack-multiset", "redblack-sum", "avl", "avl-multiset", "avl-sum",
+    "treap", "treap-multiset", "treap-sum", "llrb", "llrb-multiset", "llrb-sum",
+    "topdown", "topdown-multiset", "topdown-sum",
+    "redblack-oldest", "avl-oldest-multiset", "treap-oldest-sum",
+    "llrb-lru", "topdown-lru-multiset", "redblack-lru-sum",
+    "avl-smallest", "treap-smallest-multiset", "llrb-smallest-sum",
+    "sharded", "bucket",
+};
+
+static const int nbSubjects = sizeof(subjects) / sizeof(subjects[0]);
+
+static void subject_create(Subject* s, const char* name) {
+    memset(s, 0, sizeof(Subject));
+    s->name = name;
+    s->traversal = bstree_traversal_create(0);
+    s->executor = executor_create(2);
+    if (strcmp(name, "plain") == 0 || strcmp(name, "multiset") == 0) {
+        s->multiset = strcmp(name, "multiset") == 0;
+        s->tree = bstree_create();
+        return;
+    }
+    if (strcmp(name, "sharded") == 0) {
+        s->sharded = sharded_create(8, false);
+        return;
+    }
+    if (strcmp(name, "bucket") == 0) {
+        s->buckets = buckettree_create();
+        return;
+    }
+    for (int e = 0; e < nbEngines; ++e) {
+        size_t length = strlen(engines[e].name);
+        if (strncmp(name, engines[e].name, length) != 0)
+            continue;
+        BSTreeOptions options;
+        BSTreeAugmentation sum;
+        bstree_default_options(&options);
+        options.balancing = engines[e].balancing;
+        const char* suffix = name + length;
+        for (int p = 0; p < nbPolicies; ++p) {
+            size_t policyLength = strlen(policies[p].name);
+            if (strncmp(suffix, policies[p].name, policyLength) == 0) {
+                s->capacity = options.max_nodes = BOUNDED_CAPACITY;
+                s->eviction = options.eviction = policies[p].eviction;
+                suffix += policyLength;
+            }
+        }
+        s->summed = strcmp(suffix, "-sum") == 0;
+        s->multiset = options.multiset = s->summed || strcmp(suffix, "-multiset") == 0;
+        if (s->summed) {
+            bstree_sum_augmentation(&sum);
+            options.augmentation = &sum;
+            /* the capacity of the bounded augmented trees is given in bytes, the nodes holding the recency links,
+             * the value and the summary */
+            if (s->capacity) {
+                options.max_bytes = s->capacity * bstree_options_node_size(&options);
+                options.max_nodes = 0;
+            }
+        }
+        if (s->multiset) {
+            /* the augmented trees take their nodes from huge pages, the other ones from small malloc chunks */
+            NodePoolOptions pool;
+            nodepool_default_options(&pool);
+            pool.chunk_elements = 64;
+            pool.element_size = bstree_options_node_size(&options);
+            if (s->summed) {
+                pool.pages = pages_transparent;
+                pool.placement = placement_local;
+            }
+            s->pool = nodepool_create_with_options(&pool);
+            options.allocator = nodepool_allocator(s->pool);
+        }
+        s->handle = bstree_handle_create(&options);
+        return;
+    }
+    fprintf(stderr, "unknown subject %s\n", name);
+    exit(1);
+}
+
+static void subject_delete(Subject* s) {
+    if (s->handle)
+        bstree_handle_delete(&s->handle);
+    if (s->pool)
+        nodepool_delete(&s->pool);
+    if (s->sharded)
+        sharded_delete(&s->sharded);
+    if (s->buckets)
+        buckettree_delete(&s->buckets);
+    bstree_traversal_delete(&s->traversal);
+    executor_delete(&s->executor);
+    bstree_delete(&s->tree);
+}
+
+static const BinarySearchTree* subject_root(const Subject* s) {
+    return s->handle ? bstree_handle_root(s->handle) : s->tree;
+}
+
+static void subject_add(Subject* s, BSTreeKey v) {
+    if (s->handle)
+        bstree_handle_add(s->handle, v);
+    else if (s->sharded)
+        sharded_add(s->sharded, v);
+    else if (s->buckets)
+        buckettree_add(s->buckets, v);
+    else if (s->multiset)
+        bstree_multiset_add(&s->tree, v);
+    else
+        bstree_add(&s->tree, v);
+}
+
+static void subject_add_occurrences(Subject* s, BSTreeKey v, unsigned int n) {
+    if (s->handle)
+        bstree_handle_add_occurrences(s->handle, v, n);
+    else
+        bstree_multiset_add_occurrences(&s->tree, v, n);
+}
+
+static void subject_remove(Subject* s, BSTreeKey v, bool all) {
+    if (s->handle) {
+        if (all)
+            bstree_handle_remove_all(s->handle, v);
+        else
+            bstree_handle_remove(s->handle, v);
+    }
+    else if (s->sharded)
+        sharded_remove(s->sharded, v);
+    else if (s->buckets)
+        buckettree_remove(s->buckets, v);
+    else if (s->multiset && !all)
+        bstree_multiset_remove(&s->tree, v);
+    else
+        bstree_remove(&s->tree, v);
+}
+
+static unsigned int subject_count(Subject* s, BSTreeKey v) {
+    if (s->sharded)
+        return sharded_count(s->sharded, v);
+    if (s->buckets)
+        return buckettree_contains(s->buckets, v);
+    return bstree_count(subject_root(s), v);
+}
+
+/*------------------------  Eviction model  -----------------------------*/
+
+/** Expected recency list of a bounded subject, from the oldest key to the newest one, and number of evictions.
+ * The list is empty with the eviction_smallest policy, which does not use it. */
+typedef struct {
+    BSTreeKey keys[BOUNDED_CAPACITY + 1];
+    size_t size;
+    size_t evictions;
+} Ages;
+
+static void ages_remove(Ages* a, BSTreeKey v) {
+    for (size_t i = 0; i < a->size; ++i) {
+        if (a->keys[i] == v) {
+            memmove(&a->keys[i], &a->keys[i + 1], (a->size - i - 1) * sizeof(BSTreeKey));
+            --a->size;
+            return;
+        }
+    }
+}
+
+/* Adds n occurrences of v to the reference, then evicts as the subject does : a new key is the newest one and the
+ * keys are evicted until the capacity is met, an existing key becomes the newest one with eviction_lru. */
+static void model_add(const Subject* s, Reference* r, Ages* a, BSTreeKey v, unsigned int n) {
+    bool created = reference_add(r, v, n, s->multiset);
+    if (!s->capacity)
+        return;
+    if (s->eviction == eviction_smallest) {
+        if (created && r->size > s->capacity) {
+            reference_remove(r, r->keys[0], true);
+            ++a->evictions;
+        }
+        return;
+    }
+    if (!created && s->eviction == eviction_oldest)
+        return;
+    ages_remove(a, v);
+    a->keys[a->size++] = v;
+    if (r->size > s->capacity) {
+        reference_remove(r, a->keys[0], true);
+        ages_remove(a, a->keys[0]);
+        ++a->evictions;
+    }
+}
+
+/* Removes one occurrence of v or all of them from the reference, and from the recency list if v is gone */
+static void model_remove(const Subject* s, Reference* r, Ages* a, BSTreeKey v, bool all) {
+    reference_remove(r, v, all);
+    if (s->capacity && reference_count(r, v) == 0)
+        ages_remove(a, v);
+}
+
+/* A use of v with bstree_handle_access, v becomes the newest key with eviction_lru */
+static void model_access(const Subject* s, const Reference* r, Ages* a, BSTreeKey v) {
+    if (s->eviction == eviction_lru && reference_count(r, v) != 0) {
+        ages_remove(a, v);
+        a->keys[a->size++] = v;
+    }
+}
+
+/*------------------------  Checks  -----------------------------*/
+
+typedef struct {
+    const Reference* reference;
+    size_t index;
+    const char* error;
+} CompareEnv;
+
+static void compare_key_count(CompareEnv* e, BSTreeKey key, unsigned int count) {
+    if (e->error)
+        return;
+    if (e->index >= e->reference->size || e->reference->keys[e->index] != key)
+        e->error = "visit differs from the reference";
+    else if (e->reference->counts[e->index] != count)
+        e->error = "number of occurrences differs from the reference";
+    ++e->index;
+}
+
+static void compare_node(const BinarySearchTree* t, void* env) {
+    compare_key_count(env, bstree_key(t), bstree_multiplicity(t));
+}
+
+static void compare_key(BSTreeKey key, void* env) {
+    compare_key_count(env, key, 1);
+}
+
+typedef struct {
+    size_t nodes;
+    size_t widths;
+    int levels;
+} LevelCount;
+
+static void count_level_node(const BinarySearchTree* t, void* env) {
+    (void)t;
+    ++((LevelCount*)env)->nodes;
+}
+
+static void count_level(int depth, size_t width, void* env) {
+    LevelCount* c = env;
+    if (depth == c->levels++)
+        c->widths += width;
+}
+
+/* Visits the tree with the reusable traversal memory, which must not grow when the same tree is visited again */
+static const char* check_traversal(Subject* s, CompareEnv* env) {
+    const BinarySearchTree* t = subject_root(s);
+    bstree_traversal_depth_infix(s->traversal, t, compare_node, env);
+    if (env->error)
+        return env->error;
+    if (env->index != env->reference->size)
+        return "iterative infix visit is too short";
+    LevelCount levels = { 0, 0, 0 };
+    bstree_traversal_breadth(s->traversal, t, count_level_node, count_level, &levels);
+    size_t capacity = bstree_traversal_capacity(s->traversal);
+    if (levels.nodes != env->reference->size || levels.widths != levels.nodes)
+        return "breadth first visit differs from the reference";
+    if (levels.levels != bstree_height(t))
+        return "breadth first visit has not one level per depth";
+    bstree_traversal_breadth(s->traversal, t, NULL, NULL, NULL);
+    bstree_traversal_depth_infix(s->traversal, t, count_level_node, &levels);
+    if (bstree_traversal_capacity(s->traversal) != capacity)
+        return "traversal memory grows when it is reused";
+    return NULL;
+}
+
+/* Nodes in the order of a visit. A controlled visit stops after stop nodes, and skips the nodes whose key is
+ * congruent to skip modulo 5, if skip is not negative. */
+typedef struct {
+    const BinarySearchTree** nodes;
+    size_t size;
+    size_t stop;
+    int skip;
+} VisitEnv;
+
+static void record_node(const BinarySearchTree* t, void* env) {
+    VisitEnv* e = env;
+    e->nodes[e->size++] = t;
+}
+
+static bool skipped(const BinarySearchTree* t, int skip) {
+    return skip >= 0 && (int)((bstree_key(t) % 5 + 5) % 5) == skip;
+}
+
+static VisitAction control_node(const BinarySearchTree* t, void* env) {
+    VisitEnv* e = env;
+    record_node(t, env);
+    if (e->size == e->stop)
+        return visit_stop;
+    return skipped(t, e->skip) ? visit_skip : visit_continue;
+}
+
+BSTREE_DEFINE_DEPTH_PREFIX(inlined_prefix, record_node)
+BSTREE_DEFINE_DEPTH_INFIX(inlined_infix, record_node)
+BSTREE_DEFINE_DEPTH_PREFIX_UNTIL(inlined_prefix_until, control_node)
+BSTREE_DEFINE_DEPTH_INFIX_UNTIL(inlined_infix_until, control_node)
+
+typedef enum { order_prefix, order_infix, order_breadth } VisitOrder;
+
+/* True if a skip at an ancestor of t prunes it : any ancestor for the prefix and breadth first visits, an ancestor
+ * whose right subtree holds t for the infix visit */
+static bool pruned(const BinarySearchTree* t, int skip, VisitOrder order) {
+    for (const BinarySearchTree* child = t, *x = bstree_parent(t); !bstree_empty(x); child = x, x = bstree_parent(x)) {
+        if (skipped(x, skip) && (order != order_infix || bstree_right(x) == child))
+            return true;
+    }
+    return false;
+}
+
+/* Full visit of t in the given order, with the visitors of bstree.h. Returns the number of nodes visited. */
+static size_t full_visit(const BinarySearchTree* t, VisitOrder order, const BinarySearchTree** nodes) {
+    VisitEnv env = { nodes, 0, 0, -1 };
+    if (order == order_prefix)
+        bstree_depth_prefix(t, record_node, &env);
+    else if (order == order_infix)
+        bstree_depth_infix(t, record_node, &env);
+    else
+        bstree_iterative_breadth(t, record_node, &env);
+    return env.size;
+}
+
+/* Controlled visit of the subject in the given order, with the visitors of bstree.h or with the inlined ones (the
+ * reusable traversal for the breadth first order). Returns true if the visit was stopped. */
+static bool controlled_visit(Subject* s, VisitOrder order, bool inlined, VisitEnv* env) {
+    const BinarySearchTree* t = subject_root(s);
+    if (order == order_prefix)
+        return inlined ? inlined_prefix_until(t, env) : bstree_depth_prefix_until(t, control_node, env);
+    if (order == order_infix)
+        return inlined ? inlined_infix_until(t, env) : bstree_depth_infix_until(t, control_node, env);
+    return inlined ? bstree_traversal_breadth_until(s->traversal, t, control_node, env)
+                   : bstree_iterative_breadth_until(t, control_node, env);
+}
+
+/* Compares the controlled visits with the full visits of the same order : without action, they must visit the whole
+ * tree, with skips the whole tree but the pruned nodes, and a stopped visit must be a prefix of the skipped one.
+ * The node skipped and the one stopping the visit depend on the step. The arrays hold size nodes. */
+static const char* check_controlled(Subject* s, size_t size, const BinarySearchTree** full,
+                                    const BinarySearchTree** expected, const BinarySearchTree** nodes) {
+    const BinarySearchTree* t = subject_root(s);
+    for (VisitOrder order = order_prefix; order <= order_breadth; ++order) {
+        if (full_visit(t, order, full) != size)
+            return "visit does not visit all the nodes";
+        for (int inlined = 0; inlined < 2; ++inlined) {
+            for (int pass = 0; pass < 3; ++pass) {
+                int skip = pass == 0 ? -1 : (int)(current_step % 5);
+                size_t nb = 0;
+                for (size_t i = 0; i < size; ++i) {
+                    if (skip < 0 || !pruned(full[i], skip, order))
+                        expected[nb++] = full[i];
+                }
+                size_t stop = pass == 2 && nb > 0 ? 1 + (size_t)current_step % nb : 0;
+                VisitEnv env = { nodes, 0, stop, skip };
+                if (controlled_visit(s, order, inlined, &env) != (stop > 0))
+                    return "controlled visit not stopped as requested";
+                if (env.size != (stop > 0 ? stop : nb) || memcmp(nodes, expected, env.size * sizeof(nodes[0])) != 0)
+                    return "controlled visit differs from the full visit";
+            }
+        }
+        if (order == order_breadth)
+            continue;
+        VisitEnv env = { nodes, 0, 0, -1 };
+        if (order == order_prefix)
+            inlined_prefix(t, &env);
+        else
+            inlined_infix(t, &env);
+        if (env.size != size || memcmp(nodes, full, size * sizeof(nodes[0])) != 0)
+            return "inlined visit differs from the full visit";
+    }
+    return NULL;
+}
+
+/* Compares all the content of the subject with the reference, in both directions */
+static void check_content(Subject* s, const Reference* r) {
+    CompareEnv env = { r, 0, NULL };
+    if (s->sharded) {
+        sharded_visit(s->sharded, compare_node, &env);
+        if (!env.error && sharded_size(s->sharded) != r->size)
+            env.error = "size differs from the reference";
+    }
+    else if (s->buckets) {
+        buckettree_visit(s->buckets, compare_key, &env);
+        if (!env.error && (env.index != r->size || buckettree_size(s->buckets) != r->size))
+            env.error = "size differs from the reference";
+    }
+    else {
+        bstree_depth_infix(subject_root(s), compare_node, &env);
+        if (!env.error && env.index != r->size)
+            env.error = "size differs from the reference";
+
+        /* the iterators go from successor to successor */
+        size_t i = r->size;
+        BSTreeIterator* it = bstree_iterator_create(subject_root(s), backward);
+        for (bstree_iterator_begin(it); !env.error && !bstree_iterator_end(it); bstree_iterator_next(it)) {
+            if (i == 0 || r->keys[--i] != bstree_key(bstree_iterator_value(it)))
+                env.error = "backward iteration differs from the reference";
+        }
+        bstree_iterator_delete(&it);
+        if (!env.error && i != 0)
+            env.error = "backward iteration is too short";
+        if (!env.error) {
+            CompareEnv iterative = { r, 0, NULL };
+            env.error = check_traversal(s, &iterative);
+        }
+        if (!env.error) {
+            const BinarySearchTree** nodes = malloc((3 * r->size + 1) * sizeof(nodes[0]));
+            env.error = check_controlled(s, r->size, nodes, nodes + r->size, nodes + 2 * r->size);
+            free(nodes);
+        }
+    }
+    if (env.error)
+        fail("full comparison", 0, env.error);
+}
+
+static void check_invariants(Subject* s) {
+    const char* error = NULL;
+    if (s->handle)
+        error = bstree_handle_check(s->handle);
+    else if (s->buckets)
+        error = buckettree_check(s->buckets);
+    else if (!s->sharded)
+        error = bstree_check(s->tree);
+    if (error)
+        fail("invariants", 0, error);
+}
+
+/* Compares the neighbours of v, if it is in the tree, with the reference */
+static void check_neighbours(Subject* s, const Reference* r, BSTreeKey v) {
+    const BinarySearchTree* node = bstree_search(subject_root(s), v);
+    size_t i = reference_lower(r, v);
+    bool present = i < r->size && r->keys[i] == v;
+    if (bstree_empty(node) != !present)
+        fail("search", v, "presence differs from the reference");
+    if (!present)
+        return;
+    const BinarySearchTree* next = bstree_successor(node);
+    const BinarySearchTree* previous = bstree_predecessor(node);
+    if (i + 1 < r->size ? bstree_empty(next) || bstree_key(next) != r->keys[i + 1] : !bstree_empty(next))
+        fail("successor", v, "differs from the reference");
+    if (i > 0 ? bstree_empty(previous) || bstree_key(previous) != r->keys[i - 1] : !bstree_empty(previous))
+        fail("predecessor", v, "differs from the reference");
+}
+
+typedef struct {
+    BSTreeKey low;
+    BSTreeKey high;
+    long long sum;
+    size_t nb;
+} RangeEnv;
+
+static void range_key(BSTreeKey key, void* env) {
+    RangeEnv* e = env;
+    e->sum += key;
+    ++e->nb;
+}
+
+static void range_node(const BinarySearchTree* t, void* env) {
+    range_key(bstree_key(t), env);
+}
+
+/* Results of a batch of queries : the point queries 0 and 1 and the range query 2 */
+typedef struct {
+    const BinarySearchTree* points[2];
+    unsigned int answers[2];
+    RangeEnv range;
+    BSTreeKey last;
+    const char* error;
+} BatchEnv;
+
+static void batch_result(size_t query, const BinarySearchTree* node, void* env) {
+    BatchEnv* e = env;
+    if (query < 2) {
+        e->points[query] = node;
+        ++e->answers[query];
+        return;
+    }
+    if (e->range.nb > 0 && bstree_key(node) <= e->last)
+        e->error = "range query of a batch not in increasing order";
+    e->last = bstree_key(node);
+    range_node(node, &e->range);
+}
+
+/* Runs the point queries of low and high and the range query [low, high] as a batch, the range answer is in env */
+static const char* check_batch(Subject* s, const Reference* r, BSTreeKey low, BSTreeKey high, RangeEnv* env) {
+    TreeQuery queries[3] = { { query_point, low, low }, { query_point, high, high }, { query_range, low, high } };
+    BatchEnv batch = { { NULL, NULL }, { 0, 0 }, { low, high, 0, 0 }, 0, NULL };
+    executor_run(s->executor, subject_root(s), queries, 3, batch_result, &batch);
+    for (int q = 0; q < 2; ++q) {
+        if (batch.answers[q] != 1)
+            return "point query of a batch not answered once";
+        BSTreeKey key = queries[q].low;
+        const BinarySearchTree* node = batch.points[q];
+        if (reference_count(r, key) != 0 ? bstree_empty(node) || bstree_key(node) != key : !bstree_empty(node))
+            return "point query of a batch differs from the reference";
+    }
+    *env = batch.range;
+    return batch.error;
+}
+
+static void check_range(Subject* s, const Reference* r, BSTreeKey low, BSTreeKey high) {
+    RangeEnv env = { low, high, 0, 0 };
+    if (s->sharded)
+        sharded_range(s->sharded, low, high, range_node, &env);
+    else if (s->buckets)
+        buckettree_range(s->buckets, low, high, range_key, &env);
+    else
+        bstree_range(subject_root(s), low, high, range_node, &env);
+    long long sum = 0;
+    size_t nb = 0;
+    for (size_t i = reference_lower(r, low); i < r->size && r->keys[i] <= high; ++i) {
+        sum += r->keys[i];
+        ++nb;
+    }
+    if (env.sum != sum || env.nb != nb)
+        fail("range query", low, "differs from the reference");
+    if (!s->sharded && !s->buckets) {
+        const char* error = check_batch(s, r, low, high, &env);
+        if (error)
+            fail("batch", low, error);
+        if (env.sum != sum || env.nb != nb)
+            fail("batch", low, "range query of a batch differs from the reference");
+    }
+    if (!s->summed)
+        return;
+
+    /* the aggregate counts the occurrences */
+    BSTreeSum aggregate;
+    bstree_handle_aggregate(s->handle, low, high, &aggregate);
+    unsigned long long occurrences = 0;
+    sum = 0;
+    for (size_t i = reference_lower(r, low); i < r->size && r->keys[i] <= high; ++i) {
+        occurrences += r->counts[i];
+        sum += (long long)r->keys[i] * r->counts[i];
+    }
+    if (aggregate.occurrences != occurrences || aggregate.sum != sum)
+        fail("aggregate", low, "differs from the reference");
+}
+
+/*------------------------  Differential runs  -----------------------------*/
+
+/* Key of the differential runs for the integer k. With 64 bits keys, composite keys whose high part varies : the
+ * comparisons then involve the upper 32 bits. The order of the integers is kept.
+ */
+static BSTreeKey fuzz_key(int k) {
+    if (sizeof(BSTreeKey) == sizeof(int))
+        return k;
+    int low = (k % 8 + 8) % 8;
+    return bstree_key_compose((k - low) / 8, low);
+}
+
+/* Runs steps random operations on the subject and the reference */
+static void run_subject(const char* name, const FuzzOptions* options) {
+    Subject s;
+    Reference r;
+    Ages ages = { { 0 }, 0, 0 };
+    subject_create(&s, name);
+    reference_init(&r);
+    unsigned long long state = options->seed * 0x9e3779b97f4a7c15ull + 1;
+    current_subject = name;
+    current_seed = options->seed;
+    current_step = 0;
+    double start = now();
+    if (s.capacity && bstree_handle_capacity(s.handle) != s.capacity)
+        fail("capacity", 0, "differs from the options");
+
+    for (current_step = 0; current_step < options->steps; ++current_step) {
+        /* keys are concentrated in a small range so that removals and duplicates are frequent */
+        int k = random_below(&state, options->keys) - options->keys / 2;
+        BSTreeKey v = fuzz_key(k);
+        int operation = random_below(&state, 100);
+        if (operation < 40) {
+            subject_add(&s, v);
+            model_add(&s, &r, &ages, v, 1);
+        }
+        else if (operation < 65) {
+            subject_remove(&s, v, false);
+            model_remove(&s, &r, &ages, v, !s.multiset);
+        }
+        else if (operation < 70 && s.multiset) {
+            unsigned int n = 1 + (unsigned int)random_below(&state, 4);
+            subject_add_occurrences(&s, v, n);
+            model_add(&s, &r, &ages, v, n);
+        }
+        else if (operation < 75 && !s.sharded) {
+            subject_remove(&s, v, true);
+            model_remove(&s, &r, &ages, v, true);
+        }
+        else if (operation < 80 && s.capacity) {
+            if (bstree_empty(bstree_handle_access(s.handle, v)) != (reference_count(&r, v) == 0))
+                fail("access", v, "presence differs from the reference");
+            model_access(&s, &r, &ages, v);
+        }
+        else if (operation < 90) {
+            if (subject_count(&s, v) != reference_count(&r, v))
+                fail("count", v, "differs from the reference");
+            if (!s.sharded && !s.buckets)
+                check_neighbours(&s, &r, v);
+        }
+        else if (operation < 99) {
+            check_range(&s, &r, v, fuzz_key(k + random_below(&state, options->keys / 4 + 1)));
+        }
+        else {
+            check_content(&s, &r);
+        }
+        if (options->check_every > 0 && current_step % options->check_every == 0)
+            check_invariants(&s);
+        if (s.capacity && bstree_handle_evictions(s.handle) != ages.evictions)
+            fail("evictions", v, "number differs from the reference");
+    }
+    check_invariants(&s);
+    check_content(&s, &r);
+    printf("\t%-20s %ld steps, %zu keys at the end, %.2f s\n", name, options->steps, r.size, now() - start);
+
+    subject_delete(&s);
+    reference_free(&r);
+}
+
+/*------------------------  Differences  -----------------------------*/
+
+/* A difference between two references, in the order where bstree_diff reports them */
+typedef struct {
+    BSTreeKey key;
+    unsigned int count;
+    bool added;
+} Change;
+
+typedef struct {
+    const Change* changes;
+    size_t size;
+    size_t index;
+    const char* error;
+} DiffEnv;
+
+/* Differences from a to b : a key of a only is removed, a key of b only is added, a key of both with different
+ * numbers of occurrences is removed then added. Returns the number of differences written to changes. */
+static size_t reference_diff(const Reference* a, const Reference* b, Change* changes) {
+    size_t i = 0, j = 0, nb = 0;
+    while (i < a->size || j < b->size) {
+        if (j == b->size || (i < a->size && a->keys[i] < b->keys[j])) {
+            changes[nb++] = (Change){ a->keys[i], a->counts[i], false };
+            ++i;
+        }
+        else if (i == a->size || b->keys[j] < a->keys[i]) {
+            changes[nb++] = (Change){ b->keys[j], b->counts[j], true };
+            ++j;
+        }
+        else {
+            if (a->counts[i] != b->counts[j]) {
+                changes[nb++] = (Change){ a->keys[i], a->counts[i], false };
+                changes[nb++] = (Change){ b->keys[j], b->counts[j], true };
+            }
+            ++i;
+            ++j;
+        }
+    }
+    return nb;
+}
+
+static void diff_change(DiffEnv* e, const BinarySearchTree* t, bool added) {
+    if (e->error)
+        return;
+    const Change* c = &e->changes[e->index];
+    if (e->index == e->size || c->key != bstree_key(t) || c->count != bstree_multiplicity(t) || c->added != added)
+        e->error = "difference not in the reference";
+    ++e->index;
+}
+
+static void diff_added(const BinarySearchTree* t, void* env) {
+    diff_change(env, t, true);
+}
+
+static void diff_removed(const BinarySearchTree* t, void* env) {
+    diff_change(env, t, false);
+}
+
+/* Compares the merged and the hashed differences from a to b with the differences of the references */
+static void check_diff(const BSTreeHandle* a, const BSTreeHandle* b, const Reference* ra, const Reference* rb) {
+    Change* changes = malloc((ra->size + rb->size + 1) * sizeof(Change));
+    size_t nb = reference_diff(ra, rb, changes);
+    DiffEnv merged = { changes, nb, 0, NULL };
+    bstree_diff(bstree_handle_root(a), bstree_handle_root(b), diff_added, diff_removed, &merged);
+    if (!merged.error && merged.index != nb)
+        merged.error = "difference missing";
+    if (merged.error)
+        fail("merged difference", 0, merged.error);
+    DiffEnv hashed = { changes, nb, 0, NULL };
+    bstree_handle_diff(a, b, diff_added, diff_removed, &hashed);
+    if (!hashed.error && hashed.index != nb)
+        hashed.error = "difference missing";
+    if (hashed.error)
+        fail("hashed difference", 0, hashed.error);
+    free(changes);
+}
+
+/* Two multisets augmented with the hashes, mostly modified together so that their difference stays small and the
+ * hashed difference skips most of the keys. The smallest and the largest keys of the fuzzer are replaced by the
+ * bounds of BSTreeKey. */
+static void run_diff(const char* name, const FuzzOptions* options) {
+    BSTreeAugmentation hash;
+    BSTreeOptions treeOptions;
+    bstree_hash_augmentation(&hash);
+    bstree_default_options(&treeOptions);
+    treeOptions.multiset = true;
+    treeOptions.augmentation = &hash;
+    BSTreeHandle* trees[2];
+    Reference references[2];
+    for (int i = 0; i < 2; ++i) {
+        treeOptions.balancing = i == 0 ? balancing_redblack : balancing_treap;
+        trees[i] = bstree_handle_create(&treeOptions);
+        reference_init(&references[i]);
+    }
+    unsigned long long state = options->seed * 0x9e3779b97f4a7c15ull + 1;
+    current_subject = name;
+    current_seed = options->seed;
+    double start = now();
+
+    for (current_step = 0; current_step < options->steps; ++current_step) {
+        int k = random_below(&state, options->keys) - options->keys / 2;
+        BSTreeKey v = k == -options->keys / 2 ? BSTREE_KEY_MIN : k == options->keys - 1 - options->keys / 2 ? BSTREE_KEY_MAX : fuzz_key(k);
+        int operation = random_below(&state, 100);
+        if (operation < 50) {
+            for (int i = 0; i < 2; ++i) {
+                bstree_handle_add(trees[i], v);
+                reference_add(&references[i], v, 1, true);
+            }
+        }
+        else if (operation < 80) {
+            for (int i = 0; i < 2; ++i) {
+                bstree_handle_remove_all(trees[i], v);
+                reference_remove(&references[i], v, true);
+            }
+        }
+        else if (operation < 82) {
+            /* one occurrence more or less in one of the trees */
+            int i = random_below(&state, 2);
+            if (random_below(&state, 2)) {
+                bstree_handle_add(trees[i], v);
+                reference_add(&references[i], v, 1, true);
+            }
+            else {
+                bstree_handle_remove(trees[i], v);
+                reference_remove(&references[i], v, false);
+            }
+        }
+        else {
+            check_diff(trees[0], trees[1], &references[0], &references[1]);
+            check_diff(trees[1], trees[0], &references[1], &references[0]);
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        const char* error = bstree_handle_check(trees[i]);
+        if (error)
+            fail("invariants", 0, error);
+    }
+    check_diff(trees[0], trees[1], &references[0], &references[1]);
+    Change* changes = malloc((references[0].size + references[1].size + 1) * sizeof(Change));
+    printf("\t%-20s %ld steps, %zu keys and %zu differences at the end, %.2f s\n", name, options->steps,
+           references[0].size, reference_diff(&references[0], &references[1], changes), now() - start);
+    free(changes);
+
+    for (int i = 0; i < 2; ++i) {
+        bstree_handle_delete(&trees[i]);
+        reference_free(&references[i]);
+    }
+}
+
+/*------------------------  Intervals  -----------------------------*/
+
+/* The reference of the interval trees : the high end of the interval starting at each key, indexed by k */
+typedef struct {
+    bool* present;
+    BSTreeKey* highs;
+    int keys;
+} IntervalReference;
+
+typedef struct {
+    const IntervalReference* reference;
+    const BSTreeHandle* tree;
+    BSTreeKey low;
+    BSTreeKey high;
+    /* next index of the reference to compare */
+    int index;
+    const char* error;
+} OverlapEnv;
+
+static bool reference_overlaps(const IntervalReference* r, int i, BSTreeKey low, BSTreeKey high) {
+    return r->present[i] && fuzz_key(i - r->keys / 2) <= high && r->highs[i] >= low;
+}
+
+/* Compares a reported interval with the next overlapping interval of the reference */
+static void overlap_node(const BinarySearchTree* t, void* env) {
+    OverlapEnv* e = env;
+    const IntervalReference* r = e->reference;
+    while (e->index < r->keys && !reference_overlaps(r, e->index, e->low, e->high))
+        ++e->index;
+    if (e->error)
+        return;
+    if (e->index == r->keys || bstree_key(t) != fuzz_key(e->index - r->keys / 2) ||
+        *(const BSTreeKey*)bstree_augmented_value(e->tree, t) != r->highs[e->index])
+        e->error = "overlapping interval not in the reference";
+    ++e->index;
+}
+
+/* Compares the overlap queries of [low, high] with a scan of all the intervals of the reference */
+static void check_overlaps(const BSTreeHandle* h, const IntervalReference* r, BSTreeKey low, BSTreeKey high) {
+    OverlapEnv env = { r, h, low, high, 0, NULL };
+    bstree_handle_overlaps(h, low, high, overlap_node, &env);
+    bool any = false;
+    for (int i = 0; i < r->keys; ++i) {
+        if (reference_overlaps(r, i, low, high)) {
+            any = true;
+            if (i >= env.index && !env.error)
+                env.error = "overlapping interval missing";
+        }
+    }
+    if (env.error)
+        fail("overlaps", low, env.error);
+    const BinarySearchTree* found = bstree_handle_overlap(h, low, high);
+    if (bstree_empty(found) == any)
+        fail("overlap", low, any ? "overlapping interval missing" : "interval found without overlap");
+    if (!bstree_empty(found) && (bstree_key(found) > high || *(const BSTreeKey*)bstree_augmented_value(h, found) < low))
+        fail("overlap", low, "interval found does not overlap");
+}
+
+/* An interval tree per engine, modified together : the intervals are added, replaced and removed, the overlap queries
+ * are compared with a brute force scan. Most intervals and queries are a few keys long, so that a query often
+ * overlaps a single interval or none and skips most of the subtrees, a few intervals are much longer. */
+static void run_interval(const char* name, const FuzzOptions* options) {
+    BSTreeAugmentation interval;
+    BSTreeOptions treeOptions;
+    bstree_interval_augmentation(&interval);
+    bstree_default_options(&treeOptions);
+    treeOptions.augmentation = &interval;
+    BSTreeHandle* trees[sizeof(engines) / sizeof(engines[0])];
+    for (int e = 0; e < nbEngines; ++e) {
+        treeOptions.balancing = engines[e].balancing;
+        trees[e] = bstree_handle_create(&treeOptions);
+    }
+    IntervalReference r = { calloc(options->keys, sizeof(bool)), calloc(options->keys, sizeof(BSTreeKey)), options->keys };
+    unsigned long long state = options->seed * 0x9e3779b97f4a7c15ull + 1;
+    current_subject = name;
+    current_seed = options->seed;
+    double start = now();
+    size_t size = 0;
+
+    for (current_step = 0; current_step < options->steps; ++current_step) {
+        int i = random_below(&state, options->keys);
+        int k = i - options->keys / 2;
+        BSTreeKey low = fuzz_key(k);
+        BSTreeKey high = fuzz_key(k + random_below(&state, random_below(&state, 8) == 0 ? options->keys / 16 + 1 : 4));
+        int operation = random_below(&state, 100);
+        if (operation < 35) {
+            for (int e = 0; e < nbEngines; ++e) {
+                if (!bstree_handle_add_interval(trees[e], low, high))
+                    fail("add interval", low, "interval evicted from an unbounded tree");
+            }
+            size += !r.present[i];
+            r.present[i] = true;
+            r.highs[i] = high;
+        }
+        else if (operation < 70) {
+            for (int e = 0; e < nbEngines; ++e) {
+                if (bstree_handle_remove(trees[e], low) != r.present[i])
+                    fail("remove", low, "presence differs from the reference");
+            }
+            size -= r.present[i];
+            r.present[i] = false;
+        }
+        else {
+            high = fuzz_key(k + random_below(&state, 4));
+            for (int e = 0; e < nbEngines; ++e)
+                check_overlaps(trees[e], &r, low, high);
+        }
+        /* the engines are checked in turn */
+        if (options->check_every > 0 && current_step % options->check_every == 0) {
+            const char* error = bstree_handle_check(trees[current_step / options->check_every % nbEngines]);
+            if (error)
+                fail("invariants", 0, error);
+        }
+    }
+    for (int e = 0; e < nbEngines; ++e) {
+        const char* error = bstree_handle_check(trees[e]);
+        if (error)
+            fail("invariants", 0, error);
+        check_overlaps(trees[e], &r, BSTREE_KEY_MIN, BSTREE_KEY_MAX);
+        if (bstree_handle_size(trees[e]) != size)
+            fail("size", 0, "differs from the reference");
+    }
+    printf("\t%-20s %ld steps, %zu intervals at the end, %.2f s\n", name, options->steps, size, now() - start);
+
+    for (int e = 0; e < nbEngines; ++e)
+        bstree_handle_delete(&trees[e]);
+    free(r.present);
+    free(r.highs);
+}
+
+/*------------------------  Write-ahead log  -----------------------------*/
+
+/* How a process using the log ends */
+typedef enum {
+    /* everything logged is synced, then the process dies */
+    crash_synced,
+    /* the process dies during a checkpoint, after the new snapshot but before the new log */
+    crash_stale_log,
+    /* a torn record follows the synced ones */
+    crash_torn,
+    /* the log is found empty after a checkpoint, as a crash while the log was being emptied used to leave it */
+    crash_empty_log
+} CrashKind;
+
+static const char* const crashes[] = { "synced", "stale log", "torn record", "empty log" };
+
+/* Crash of each round, in a cycle. Each crash during a checkpoint is followed by the other kinds. */
+static const CrashKind schedule[] = { crash_synced, crash_stale_log, crash_synced, crash_torn, crash_empty_log, crash_torn };
+
+static const int nbRounds = sizeof(schedule) / sizeof(schedule[0]);
+
+static bool checkpoint_crash(CrashKind crash) {
+    return crash == crash_stale_log || crash == crash_empty_log;
+}
+
+typedef struct {
+    BSTreeKey key;
+    bool add;
+} LoggedOperation;
+
+/* Reads the whole file, returns its length or -1 */
+static long read_file(const char* filename, char* buffer, size_t capacity) {
+    FILE* input = fopen(filename, "rb");
+    if (!input)
+        return -1;
+    size_t length = fread(buffer, 1, capacity, input);
+    bool complete = feof(input);
+    fclose(input);
+    return complete ? (long)length : -1;
+}
+
+static bool write_file(const char* filename, const char* buffer, size_t length, const char* mode) {
+    FILE* output = fopen(filename, mode);
+    if (!output)
+        return false;
+    bool written = fwrite(buffer, 1, length, output) == length;
+    return fclose(output) == 0 && written;
+}
+
+/* Child process : opens the log after the recovery, applies the operations to the recovered tree and the log with a
+ * checkpoint after the operation checkpoint, if any, then dies as requested, without closing the log. */
+static void crash_process(BinarySearchTree* t, const WalRecovery* recovery, const char* log, const char* snapshot,
+                          const LoggedOperation* operations, size_t nb, size_t checkpoint, CrashKind crash) {
+    WalOptions options;
+    wal_default_options(&options);
+    options.flush_interval = 0.001;
+    options.buffer_records = 64;
+    options.sync = false;
+    WriteAheadLog* l = wal_open(log, recovery->generation, &options);
+    if (!l)
+        _exit(2);
+    static char previous[1 << 20];
+    long length = 0;
+    for (size_t i = 0; i < nb; ++i) {
+        if (operations[i].add) {
+            wal_log_add(l, operations[i].key);
+            bstree_multiset_add(&t, operations[i].key);
+        }
+        else {
+            wal_log_remove(l, operations[i].key);
+            bstree_multiset_remove(&t, operations[i].key);
+        }
+        if (i != checkpoint)
+            continue;
+        if (crash == crash_stale_log && (!wal_sync(l) || (length = read_file(log, previous, sizeof(previous))) < 0))
+            _exit(2);
+        if (!wal_checkpoint(l, t, snapshot))
+            _exit(2);
+        if (checkpoint_crash(crash))
+            _exit(write_file(log, previous, crash == crash_stale_log ? (size_t)length : 0, "wb") ? 0 : 2);
+    }
+    if (!wal_sync(l))
+        _exit(2);
+    if (crash == crash_torn) {
+        const char torn[5] = { 1, 2, 3, 4, 5 };
+        if (!write_file(log, torn, sizeof(torn), "ab"))
+            _exit(2);
+    }
+    _exit(0);
+}
+
+/* Rounds of operations logged by a child process which then crashes in different ways. Each round starts by
+ * recovering the tree from the snapshot and the log left by the previous one, which must contain every operation
+ * synced so far. The other rounds checkpoint at a random operation, so that their operations are split between two
+ * generations of the log. */
+static void run_wal(const char* name, const FuzzOptions* options) {
+    char directory[] = "/tmp/bstreefuzz-XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    char log[64], snapshot[64];
+    snprintf(log, sizeof(log), "%s/log", directory);
+    snprintf(snapshot, sizeof(snapshot), "%s/snapshot", directory);
+    unsigned long long state = options->seed * 0x9e3779b97f4a7c15ull + 1;
+    current_subject = name;
+    current_seed = options->seed;
+    double start = now();
+    Reference r;
+    reference_init(&r);
+    LoggedOperation* operations = malloc(1024 * sizeof(LoggedOperation));
+    long rounds = 0;
+
+    for (current_step = 0; current_step < options->steps; ++rounds) {
+        BinarySearchTree* t = bstree_create();
+        WalRecovery recovery = wal_recover(snapshot, log, &t, true);
+        CompareEnv env = { &r, 0, NULL };
+        bstree_depth_infix(t, compare_node, &env);
+        if (!env.error && env.index != r.size)
+            env.error = "size differs from the reference";
+        if (env.error)
+            fail("recovery", 0, env.error);
+        CrashKind previous = schedule[(rounds + nbRounds - 1) % nbRounds];
+        if (rounds > 0 && recovery.truncated != (previous == crash_torn))
+            fail("recovery", 0, "torn record not reported");
+
+        /* A crash during the checkpoint ends the round. The round after it does not checkpoint : its operations are
+         * only in the log opened after the crash. */
+        CrashKind crash = schedule[rounds % nbRounds];
+        size_t nb = 1 + (size_t)random_below(&state, 1024);
+        size_t checkpoint = (size_t)random_below(&state, (int)nb);
+        if (checkpoint_crash(crash))
+            checkpoint = nb - 1;
+        else if (rounds > 0 && checkpoint_crash(previous))
+            checkpoint = nb;
+        for (size_t i = 0; i < nb; ++i) {
+            int k = random_below(&state, options->keys) - options->keys / 2;
+            operations[i] = (LoggedOperation){ fuzz_key(k), random_below(&state, 3) < 2 };
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0)
+            crash_process(t, &recovery, log, snapshot, operations, nb, checkpoint, crash);
+        bstree_delete(&t);
+        int status;
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fail(crashes[crash], 0, "the logging process failed");
+        for (size_t i = 0; i < nb; ++i) {
+            if (operations[i].add)
+                reference_add(&r, operations[i].key, 1, true);
+            else
+                reference_remove(&r, operations[i].key, false);
+        }
+        current_step += (long)nb;
+    }
+    printf("\t%-20s %ld steps in %ld crashes, %zu keys at the end, %.2f s\n", name, current_step, rounds, r.size,
+           now() - start);
+
+    free(operations);
+    reference_free(&r);
+    char temporary[80];
+    const char* files[2] = { log, snapshot };
+    for (int i = 0; i < 2; ++i) {
+        unlink(files[i]);
+        snprintf(temporary, sizeof(temporary), "%s.tmp", files[i]);
+        unlink(temporary);
+    }
+    rmdir(directory);
+}
+
+/*------------------------  Ingestion  -----------------------------*/
+
+/* Writes a random token to the input and adds the keys it stands for to the expected tree, or counts them in ignored.
+ * The tokens are integers, the bounds of BSTreeKey, integers out of its range, composite keys with their parts in or
+ * out of range, and malformed tokens. */
+static void ingest_token(FILE* input, ptrBinarySearchTree* expected, unsigned long long* ignored,
+                         unsigned long long* state, int keys) {
+    long long half = 1LL << (BSTREE_KEY_HALF_BITS - 1);
+    int n = random_below(state, keys) - keys / 2;
+    int m = random_below(state, keys);
+    BSTreeKey high = (BSTreeKey)(n % half);
+    BSTreeKey low = (BSTreeKey)(m % (2 * half));
+    static const char* const malformed[] = { "-", ":", "-:", "::", "abc", "+-" };
+    unsigned long long beyond = (unsigned long long)BSTREE_KEY_MAX + 1 + (unsigned long long)m;
+    switch (random_below(state, 11)) {
+    case 0:
+        fprintf(input, "%d", n);
+        bstree_multiset_add(expected, n);
+        break;
+    case 1: {
+        BSTreeKey bound = random_below(state, 2) ? BSTREE_KEY_MIN : BSTREE_KEY_MAX;
+        fprintf(input, "%" BSTREE_KEY_FORMAT, bound);
+        bstree_multiset_add(expected, bound);
+        break;
+    }
+    case 2:
+        fprintf(input, "%" BSTREE_KEY_FORMAT ":%" BSTREE_KEY_FORMAT, high, low);
+        bstree_multiset_add(expected, bstree_key_compose(high, low));
+        break;
+    case 3:
+        /* out of range : ignored */
+        if (random_below(state, 2))
+            fprintf(input, "%lld:%d", half + m, m);
+        else
+            fprintf(input, "%d:%lld", n, 2 * half + m);
+        ++*ignored;
+        break;
+    case 4:
+        /* a ':' without low part only ends the key */
+        fprintf(input, "%d:", n);
+        bstree_multiset_add(expected, n);
+        break;
+    case 5:
+        fprintf(input, ":%d", n);
+        bstree_multiset_add(expected, n);
+        break;
+    case 6:
+        /* a second ':' ends the composite key */
+        fprintf(input, "%" BSTREE_KEY_FORMAT ":%" BSTREE_KEY_FORMAT ":%d", high, low, n);
+        bstree_multiset_add(expected, bstree_key_compose(high, low));
+        bstree_multiset_add(expected, n);
+        break;
+    case 7:
+        /* a '-' right after a number starts the next, negative, one */
+        fprintf(input, "%d-%d", n, m);
+        bstree_multiset_add(expected, n);
+        bstree_multiset_add(expected, -m);
+        break;
+    case 8:
+        fprintf(input, "--%d", m);
+        bstree_multiset_add(expected, -m);
+        break;
+    case 9:
+        /* integers out of range : ignored, even when their digits do not fit in 64 bits */
+        switch (random_below(state, 4)) {
+        case 0:
+            fprintf(input, "%llu", beyond);
+            break;
+        case 1:
+            fprintf(input, "-%llu", beyond + 1);
+            break;
+        case 2:
+            fprintf(input, "%" BSTREE_KEY_FORMAT "%020d", BSTREE_KEY_MIN, m);
+            break;
+        default:
+            /* a ':' without low part after an out of range integer */
+            fprintf(input, "%llu:", beyond);
+            break;
+        }
+        ++*ignored;
+        break;
+    default:
+        fputs(malformed[random_below(state, sizeof(malformed) / sizeof(malformed[0]))], input);
+        break;
+    }
+    static const char* const separators[] = { " ", "\n", "\t", ",", " ; ", "\r\n", "x" };
+    fputs(separators[random_below(state, sizeof(separators) / sizeof(separators[0]))], input);
+}
+
+static void ingest_difference(const BinarySearchTree* t, void* env) {
+    (void)t;
+    ++*(size_t*)env;
+}
+
+static void ingest_count(const BinarySearchTree* t, void* env) {
+    IngestStats* stats = env;
+    stats->keys += bstree_multiplicity(t);
+    ++stats->distinct;
+}
+
+/* Rounds of random tokens, each one ingested with several sizes of chunks and of batches so that the tokens are
+ * split between chunks at every position. The trees are compared with the tree built by bstree_multiset_add. */
+static void run_ingest(const char* name, const FuzzOptions* options) {
+    static const size_t chunks[] = { 1, 2, 3, 7, 64, 4096 };
+    static const size_t batches[] = { 1, 5, 1 << 16 };
+    unsigned long long state = options->seed * 0x9e3779b97f4a7c15ull + 1;
+    current_subject = name;
+    current_seed = options->seed;
+    double start = now();
+    size_t keys = 0;
+
+    for (current_step = 0; current_step < options->steps;) {
+        FILE* input = tmpfile();
+        if (!input) {
+            perror("tmpfile");
+            exit(1);
+        }
+        BinarySearchTree* expected = bstree_create();
+        IngestStats reference = { 0, 0, 0, 0. };
+        long nb = 1 + random_below(&state, 256);
+        for (long i = 0; i < nb; ++i)
+            ingest_token(input, &expected, &reference.ignored, &state, options->keys);
+        fflush(input);
+        bstree_depth_infix(expected, ingest_count, &reference);
+
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+            IngestOptions ingest;
+            ingest_default_options(&ingest);
+            ingest.buffer_size = chunks[c];
+            ingest.batch_size = batches[c % (sizeof(batches) / sizeof(batches[0]))];
+            ingest.report_interval = 0;
+            ingest.report = NULL;
+            if (lseek(fileno(input), 0, SEEK_SET) != 0) {
+                perror("lseek");
+                exit(1);
+            }
+            BinarySearchTree* t = bstree_create();
+            IngestStats stats = ingest_stream(input, &t, &ingest);
+            size_t differences = 0;
+            bstree_diff(expected, t, ingest_difference, ingest_difference, &differences);
+            if (differences != 0 || stats.keys != reference.keys || stats.distinct != reference.distinct ||
+                stats.ignored != reference.ignored)
+                fail("ingestion in chunks of", (BSTreeKey)chunks[c], "differs from the reference");
+            const char* error = bstree_check(t);
+            if (error)
+                fail("ingestion in chunks of", (BSTreeKey)chunks[c], error);
+            bstree_delete(&t);
+        }
+        keys += reference.keys;
+        bstree_delete(&expected);
+        fclose(input);
+        current_step += nb;
+    }
+    printf("\t%-20s %ld tokens, %zu keys, %.2f s\n", name, current_step, keys, now() - start);
+}
+
+/*------------------------  Skewed shards  -----------------------------*/
+
+/* Fails if a shard holds more than twice the average plus the margin of the rebalance, or, once the average is
+ * above this margin, less than half the average. */
+static void check_shards(ShardedTree* st, const char* operation) {
+    const size_t margin = 1024;
+    unsigned int nb = sharded_nb_shards(st);
+    size_t average = sharded_size(st) / nb;
+    for (unsigned int i = 0; i < nb; ++i) {
+        size_t size = sharded_shard_size(st, i);
+        if (size > 2 * average + margin || (average >= margin && size < average / 2))
+            fail(operation, (BSTreeKey)i, "shard not balanced");
+    }
+}
+
+/* Increasing then decreasing keys, as identifiers given by a counter, fill the shards one after the other : the
+ * rebalance must spread them over all the shards. Removing the oldest keys then empties the first shards. */
+static void run_skew(const char* name, const FuzzOptions* options) {
+    current_subject = name;
+    current_seed = options->seed;
+    current_step = options->steps;
+    long n = options->steps;
+    for (int direction = 1; direction >= -1; direction -= 2) {
+        double start = now();
+        Subject s;
+        memset(&s, 0, sizeof(Subject));
+        s.name = name;
+        s.sharded = sharded_create(8, false);
+        Reference r;
+        r.size = r.capacity = (size_t)n;
+        r.keys = malloc((size_t)n * sizeof(BSTreeKey));
+        r.counts = malloc((size_t)n * sizeof(unsigned int));
+        for (long i = 0; i < n; ++i) {
+            sharded_add(s.sharded, (BSTreeKey)(direction * i));
+            r.keys[direction > 0 ? i : n - 1 - i] = (BSTreeKey)(direction * i);
+            r.counts[i] = 1;
+        }
+        double insertion = now() - start;
+        check_shards(s.sharded, "sequential insertions");
+        check_content(&s, &r);
+
+        /* the oldest three quarters of the keys are removed */
+        for (long i = 0; i < 3 * n / 4; ++i)
+            sharded_remove(s.sharded, (BSTreeKey)(direction * i));
+        r.size = (size_t)(n - 3 * n / 4);
+        if (direction > 0)
+            memmove(r.keys, r.keys + 3 * n / 4, r.size * sizeof(BSTreeKey));
+        sharded_rebalance(s.sharded);
+        check_shards(s.sharded, "removal of the oldest keys");
+        check_content(&s, &r);
+
+        printf("\t%-20s %ld %s keys in %.2f s, shards", name, n, direction > 0 ? "increasing" : "decreasing",
+               insertion);
+        for (unsigned int i = 0; i < sharded_nb_shards(s.sharded); ++i)
+            printf(" %zu", sharded_shard_size(s.sharded, i));
+        printf("\n");
+        sharded_delete(&s.sharded);
+        reference_free(&r);
+    }
+}
+
+/* Differential runs that are not a single tree under test, selected by name like the subjects */
+static const struct {
+    const char* name;
+    void (*run)(const char* name, const FuzzOptions* options);
+} scenarios[] = {
+    { "diff", run_diff },
+    { "interval", run_interval },
+    { "wal", run_wal },
+    { "ingest", run_ingest },
+    { "skew", run_skew },
+};
+
+static const int nbScenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+
+/*------------------------  Large scale  -----------------------------*/
+
+static int compare_keys(const void* a, const void* b) {
+    BSTreeKey x = *(const BSTreeKey*)a;
+    BSTreeKey y = *(const BSTreeKey*)b;
+    return (x > y) - (x < y);
+}
+
+/* Inserts n random keys in each engine, removes half of them and checks the result once, with timings. The
+ * reference is a sorted copy of the keys, built once. */
+static void run_large(const FuzzOptions* options) {
+    long n = options->large;
+    BSTreeKey* keys = malloc((size_t)n * sizeof(BSTreeKey));
+    unsigned long long state = options->seed * 0x9e3779b97f4a7c15ull + 1;
+    /* keys spread over the whole range of BSTreeKey */
+    for (long i = 0; i < n; ++i)
+        keys[i] = (BSTreeKey)(next_random(&state) >> (64 - 8 * sizeof(BSTreeKey)));
+
+    Reference r;
+    r.size = r.capacity = 0;
+    r.keys = malloc((size_t)n * sizeof(BSTreeKey));
+    r.counts = malloc((size_t)n * sizeof(unsigned int));
+    /* the keys of odd index are removed, a key also present at an even index stays */
+    for (long i = 0; i < n; i += 2)
+        r.keys[r.size++] = keys[i];
+    qsort(r.keys, r.size, sizeof(BSTreeKey), compare_keys);
+    size_t distinct = 0;
+    for (size_t i = 0; i < r.size; ++i) {
+        if (distinct == 0 || r.keys[distinct - 1] != r.keys[i])
+            r.keys[distinct++] = r.keys[i];
+    }
+    r.size = distinct;
+    for (size_t i = 0; i < r.size; ++i)
+        r.counts[i] = 1;
+
+    current_seed = options->seed;
+    current_step = n;
+    for (int e = 0; e < nbEngines; ++e) {
+        Subject s;
+        subject_create(&s, engines[e].name);
+        current_subject = engines[e].name;
+
+        double start = now();
+        for (long i = 0; i < n; ++i)
+            subject_add(&s, keys[i]);
+        double insertion = now() - start;
+        start = now();
+        for (long i = 1; i < n; i += 2) {
+            if (bsearch(&keys[i], r.keys, r.size, sizeof(BSTreeKey), compare_keys) == NULL)
+                subject_remove(&s, keys[i], false);
+        }
+        double removal = now() - start;
+        start = now();
+        check_invariants(&s);
+        check_content(&s, &r);
+        double check = now() - start;
+        printf("\t%-10s %ld insertions %.2f s, %ld removals %.2f s, height %d, checked in %.2f s\n",
+               engines[e].name, n, insertion, n / 2, removal, bstree_height(subject_root(&s)), check);
+        subject_delete(&s);
+    }
+    free(keys);
+    reference_free(&r);
+}
+
+/*------------------------  Concurrent writers  -----------------------------*/
+
+typedef struct {
+    ShardedTree* tree;
+    int id;
+    int nb_threads;
+    const FuzzOptions* options;
+    Reference reference;
+} WriterEnv;
+
+/* Each writer owns the keys congruent to its id, so that its own reference is exact */
+static void* writer(void* env) {
+    WriterEnv* e = env;
+    unsigned long long state = (e->options->seed + (unsigned long long)e->id) * 0x9e3779b97f4a7c15ull + 1;
+    reference_init(&e->reference);
+    for (long step = 0; step < e->options->steps; ++step) {
+        int v = (random_below(&state, e->options->keys) - e->options->keys / 2) * e->nb_threads + e->id;
+        if (random_below(&state, 3) < 2) {
+            sharded_add(e->tree, v);
+            reference_add(&e->reference, v, 1, false);
+        }
+        else {
+            sharded_remove(e->tree, v);
+            reference_remove(&e->reference, v, true);
+        }
+    }
+    return NULL;
+}
+
+static void run_threads(const FuzzOptions* options) {
+    int nb = options->threads;
+    ShardedTree* st = sharded_create(8, false);
+    pthread_t* threads = malloc((size_t)nb * sizeof(pthread_t));
+    WriterEnv* envs = malloc((size_t)nb * sizeof(WriterEnv));
+    double start = now();
+    for (int t = 0; t < nb; ++t) {
+        envs[t] = (WriterEnv){ st, t, nb, options, { NULL, NULL, 0, 0 } };
+        pthread_create(&threads[t], NULL, writer, &envs[t]);
+    }
+    for (int t = 0; t < nb; ++t)
+        pthread_join(threads[t], NULL);
+
+    /* the union of the references of the writers is the expected content */
+    Reference r;
+    reference_init(&r);
+    for (int t = 0; t < nb; ++t) {
+        for (size_t i = 0; i < envs[t].reference.size; ++i)
+            reference_add(&r, envs[t].reference.keys[i], 1, false);
+        reference_free(&envs[t].reference);
+    }
+    Subject s;
+    memset(&s, 0, sizeof(Subject));
+    s.name = current_subject = "sharded-threads";
+    s.sharded = st;
+    current_seed = options->seed;
+    current_step = options->steps;
+    check_content(&s, &r);
+    printf("\t%d writers, %ld steps each, %zu keys at the end, %.2f s\n", nb, options->steps, r.size,
+           now() - start);
+
+    reference_free(&r);
+    sharded_delete(&st);
+    free(envs);
+    free(threads);
+}
+
+/*------------------------  Driver  -----------------------------*/
+
+static void usage(const char* program) {
+    fprintf(stderr, "usage : %s [--seed n] [--steps n] [--keys n] [--check-every n] [--subject name|all]\n"
+                    "       %s --large n [--seed n]\n"
+                    "       %s --threads n [--steps n] [--keys n] [--seed n]\n"
+                    "subjects :", program, program, program);
+    for (int i = 0; i < nbSubjects; ++i)
+        fprintf(stderr, " %s", subjects[i]);
+    for (int i = 0; i < nbScenarios; ++i)
+        fprintf(stderr, " %s", scenarios[i].name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/** Fuzzer driver.
+ * By default, each subject runs 100000 random operations on keys in a range of 1000 values, with a full check
+ * of the invariants after each step, then each scenario runs as many steps. A failure prints the subject, the seed and the step, and exits with 1.
+ */
+int main(int argc, char** argv) {
+    FuzzOptions options = { 1, 100000, 1000, 1, "all", 0, 0 };
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc)
+            usage(argv[0]);
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "--seed") == 0)
+            options.seed = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "--steps") == 0)
+            options.steps = atol(value);
+        else if (strcmp(argv[i - 1], "--keys") == 0)
+            options.keys = atoi(value);
+        else if (strcmp(argv[i - 1], "--check-every") == 0)
+            options.check_every = atol(value);
+        else if (strcmp(argv[i - 1], "--subject") == 0)
+            options.subject = value;
+        else if (strcmp(argv[i - 1], "--large") == 0)
+            options.large = atol(value);
+        else if (strcmp(argv[i - 1], "--threads") == 0)
+            options.threads = atoi(value);
+        else
+            usage(argv[0]);
+    }
+    if (options.keys <= 0 || options.steps < 0 || options.large < 0 || options.threads < 0)
+        usage(argv[0]);
+
+    if (options.large > 0) {
+        printf("Large scale run, seed %llu.\n", options.seed);
+        run_large(&options);
+    }
+    else if (options.threads > 0) {
+        printf("Concurrent writers on a sharded tree, seed %llu.\n", options.seed);
+        run_threads(&options);
+    }
+    else {
+        printf("Differential run, seed %llu.\n", options.seed);
+        bool ran = false;
+        for (int i = 0; i < nbSubjects; ++i) {
+            if (strcmp(options.subject, "all") == 0 || strcmp(options.subject, subjects[i]) == 0) {
+                run_subject(subjects[i], &options);
+                ran = true;
+            }
+        }
+        for (int i = 0; i < nbScenarios; ++i) {
+            if (strcmp(options.subject, "all") == 0 || strcmp(options.subject, scenarios[i].name) == 0) {
+                scenarios[i].run(scenarios[i].name, &options);
+                ran = true;
+            }
+        }
+        if (!ran)
+            usage(argv[0]);
+    }
+    printf("Done.\n");
+    return 0;
+}
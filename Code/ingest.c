@@ -0,0 +1,241 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Streaming ingestion of keys into a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include "ingest.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+void ingest_default_options(IngestOptions* options) {
+    options->buffer_size = 1 << 20;
+    options->batch_size = 1 << 16;
+    options->report_interval = 1.0;
+    options->report = stderr;
+    options->snapshot = NULL;
+    options->log = NULL;
+}
+
+/* Current time in seconds, from a monotonic clock */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* State of the parser, kept between two chunks as a key may be split between them */
+typedef struct {
+    /* absolute value of the integer being read, stuck at ULLONG_MAX once it is out of range */
+    unsigned long long value;
+    bool in_number;
+    bool negative;
+    /* first part of a composite key "high:low", when its ':' has been read */
+    long long high;
+    bool high_valid;
+    bool composite;
+} ParserState;
+
+/* Full state of the ingestion */
+typedef struct {
+    const IngestOptions* options;
+    ptrBinarySearchTree* tree;
+    BSTreeKey* batch;
+    size_t batch_length;
+    IngestStats stats;
+    double start;
+    double last_report;
+    unsigned long long last_keys;
+} Ingestion;
+
+static int compare_keys(const void* a, const void* b) {
+    BSTreeKey x = *(const BSTreeKey*)a;
+    BSTreeKey y = *(const BSTreeKey*)b;
+    return (x > y) - (x < y);
+}
+
+/* Adds the pending keys to the tree. Sorting the batch first makes consecutive insertions follow
+ * mostly the same path, which is then already in cache.
+ */
+static void flush_batch(Ingestion* ingestion) {
+    qsort(ingestion->batch, ingestion->batch_length, sizeof(BSTreeKey), compare_keys);
+    if (ingestion->options->log) {
+        for (size_t i = 0; i < ingestion->batch_length; ++i)
+            wal_log_add(ingestion->options->log, ingestion->batch[i]);
+    }
+    for (size_t i = 0; i < ingestion->batch_length; ++i) {
+        if (bstree_multiset_add(ingestion->tree, ingestion->batch[i]) == 1)
+            ++ingestion->stats.distinct;
+    }
+    ingestion->stats.keys += ingestion->batch_length;
+    ingestion->batch_length = 0;
+}
+
+static void report(Ingestion* ingestion, double time) {
+    const IngestOptions* options = ingestion->options;
+    ingestion->stats.seconds = time - ingestion->start;
+    if (options->report) {
+        double period = time - ingestion->last_report;
+        fprintf(options->report, "ingest : %llu keys (%llu distinct, %llu ignored) in %.1f s, %.0f keys/s, last period %.0f keys/s\n",
+                ingestion->stats.keys, ingestion->stats.distinct, ingestion->stats.ignored, ingestion->stats.seconds,
+                ingestion->stats.seconds > 0 ? ingestion->stats.keys / ingestion->stats.seconds : 0.,
+                period > 0 ? (ingestion->stats.keys - ingestion->last_keys) / period : 0.);
+        fflush(options->report);
+    }
+    if (options->snapshot && options->log) {
+        if (!wal_checkpoint(options->log, *ingestion->tree, options->snapshot))
+            perror(options->snapshot);
+    }
+    else if (options->snapshot && !ingest_snapshot(*ingestion->tree, options->snapshot))
+        perror(options->snapshot);
+    ingestion->last_report = time;
+    ingestion->last_keys = ingestion->stats.keys;
+}
+
+/* Whether the integer being read fits in a BSTreeKey, like for bstree_key_parse */
+static bool in_key_range(const ParserState* state) {
+    return state->value <= (unsigned long long)BSTREE_KEY_MAX + state->negative;
+}
+
+static long long parsed_value(const ParserState* state) {
+    return (long long)(state->negative ? 0 - state->value : state->value);
+}
+
+/* Adds the key that was just read to the batch, or counts it as ignored if it is out of range */
+static void push_key(Ingestion* ingestion, ParserState* state) {
+    BSTreeKey key = 0;
+    bool valid;
+    if (state->composite && !state->in_number) {
+        /* the ':' was not followed by a number : it only ended the key */
+        valid = state->high_valid;
+        key = (BSTreeKey)state->high;
+    } else if (state->composite) {
+        long long half = 1LL << (BSTREE_KEY_HALF_BITS - 1);
+        valid = state->high_valid && state->high >= -half && state->high < half && !state->negative &&
+                state->value < (unsigned long long)(2 * half);
+        if (valid)
+            key = bstree_key_compose((BSTreeKey)state->high, (BSTreeKey)state->value);
+    } else {
+        valid = in_key_range(state);
+        key = (BSTreeKey)parsed_value(state);
+    }
+    if (valid) {
+        ingestion->batch[ingestion->batch_length++] = key;
+        if (ingestion->batch_length == ingestion->options->batch_size)
+            flush_batch(ingestion);
+    } else
+        ++ingestion->stats.ignored;
+    state->value = 0;
+    state->in_number = false;
+    state->negative = false;
+    state->composite = false;
+}
+
+static void parse_chunk(Ingestion* ingestion, ParserState* state, const char* chunk, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        char c = chunk[i];
+        if (c >= '0' && c <= '9') {
+            if (state->value > (ULLONG_MAX - 9) / 10)
+                state->value = ULLONG_MAX;
+            else
+                state->value = state->value * 10 + (unsigned long long)(c - '0');
+            state->in_number = true;
+        } else if (c == ':' && state->in_number && !state->composite) {
+            state->high_valid = in_key_range(state);
+            state->high = parsed_value(state);
+            state->composite = true;
+            state->value = 0;
+            state->in_number = false;
+            state->negative = false;
+        } else {
+            if (state->in_number || state->composite)
+                push_key(ingestion, state);
+            state->negative = (c == '-');
+        }
+    }
+}
+
+IngestStats ingest_stream(FILE* input, ptrBinarySearchTree* t, const IngestOptions* options) {
+    Ingestion ingestion;
+    memset(&ingestion, 0, sizeof(Ingestion));
+    ingestion.options = options;
+    ingestion.tree = t;
+    ingestion.batch = malloc(options->batch_size * sizeof(BSTreeKey));
+    ingestion.start = ingestion.last_report = now();
+
+    char* buffer = malloc(options->buffer_size);
+    ParserState state = { 0, false, false, 0, false, false };
+    int fd = fileno(input);
+
+    for (;;) {
+        double time = now();
+        if (options->report_interval > 0 && time - ingestion.last_report >= options->report_interval)
+            report(&ingestion, time);
+        /* Before a read that may block, wait for the input : the pending keys are added as soon as the producer
+         * stalls, and the reports go on while it is idle. */
+        int timeout = -1;
+        if (ingestion.batch_length > 0)
+            timeout = 0;
+        else if (options->report_interval > 0)
+            timeout = (int)((ingestion.last_report + options->report_interval - time) * 1000) + 1;
+        if (timeout >= 0) {
+            struct pollfd waiting = { fd, POLLIN, 0 };
+            int ready = poll(&waiting, 1, timeout);
+            if (ready == 0)
+                flush_batch(&ingestion);
+            if (ready == 0 || (ready < 0 && errno == EINTR))
+                continue;
+            if (ready < 0) {
+                perror("Unable to wait for the input stream");
+                break;
+            }
+        }
+
+        ssize_t length = read(fd, buffer, options->buffer_size);
+        if (length == 0)
+            break;
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("Unable to read the input stream");
+            break;
+        }
+        parse_chunk(&ingestion, &state, buffer, (size_t)length);
+        /* A short read means the producer is slower than us : do not keep keys waiting for a full batch */
+        if ((size_t)length < options->buffer_size)
+            flush_batch(&ingestion);
+    }
+    if (state.in_number || state.composite)
+        push_key(&ingestion, &state);
+    flush_batch(&ingestion);
+    report(&ingestion, now());
+
+    free(buffer);
+    free(ingestion.batch);
+    return ingestion.stats;
+}
+
+/* Writes a node of the snapshot */
+static void snapshot_node(const BinarySearchTree* t, void* stream) {
+    fprintf((FILE*)stream, "%" BSTREE_KEY_FORMAT " %u\n", bstree_key(t), bstree_multiplicity(t));
+}
+
+bool ingest_snapshot(const BinarySearchTree* t, const char* filename) {
+    char temporary[4096];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", filename) >= (int)sizeof(temporary))
+        return false;
+    FILE* output = fopen(temporary, "w");
+    if (!output)
+        return false;
+    bstree_depth_infix(t, snapshot_node, output);
+    if (fclose(output) != 0)
+        return false;
+    return rename(temporary, filename) == 0;
+}
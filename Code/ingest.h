@@ -0,0 +1,74 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Streaming ingestion of keys into a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __INGEST__H__
+#define __INGEST__H__
+#include <stdio.h>
+#include "bstree.h"
+#include "wal.h"
+
+/** \defgroup Ingest Streaming ingestion of an unbounded sequence of keys.
+ * @{
+ * Keys are read from a file, a pipe or a FIFO until the end of the stream, without any header giving their
+ * number. Any character that is not part of an integer separates the keys, except a ':' between two integers
+ * which writes the composite key "high:low", see bstree_key_compose. An integer out of the range of BSTreeKey, or a
+ * composite key whose parts are out of range, is ignored and counted in the statistics : the keys are the same as
+ * with bstree_key_parse. Keys are added to the tree as a multiset, so the tree counts the occurrences of each key.
+ */
+
+/** Parameters of the ingestion. */
+typedef struct {
+    /** size in bytes of the chunks read from the input. */
+    size_t buffer_size;
+    /** maximum number of keys added to the tree at once. */
+    size_t batch_size;
+    /** number of seconds between two reports, 0 to report only at the end of the stream. The reports go on while
+     * the input is idle. */
+    double report_interval;
+    /** stream where the reports are written, NULL to disable the reports. */
+    FILE* report;
+    /** file where the tree is dumped at each report, NULL to disable the snapshots. */
+    const char* snapshot;
+    /** log where the keys are recorded before being added to the tree, NULL to disable the log. With a log, the
+     * snapshots are checkpoints of the log, see wal_checkpoint. */
+    WriteAheadLog* log;
+} IngestOptions;
+
+/** Statistics of an ingestion. */
+typedef struct {
+    /** number of keys read. */
+    unsigned long long keys;
+    /** number of keys that were not yet in the tree. */
+    unsigned long long distinct;
+    /** number of keys out of range, not added to the tree. */
+    unsigned long long ignored;
+    /** duration of the ingestion, in seconds. */
+    double seconds;
+} IngestStats;
+
+/** Constructor : fills the options with default values.
+ * 1MB chunks, batches of 64K keys, reports every second on stderr, no snapshot, no log.
+ */
+void ingest_default_options(IngestOptions* options);
+
+/** Reads keys from input until the end of the stream and adds them to the tree t.
+ * The read is done with the file descriptor of input, so that a FIFO or a pipe is processed as soon as data is
+ * available instead of waiting for a full chunk. The keys of a chunk wait for a full batch only while the input keeps
+ * the reads full.
+ * @return the statistics of the ingestion.
+ */
+IngestStats ingest_stream(FILE* input, ptrBinarySearchTree* t, const IngestOptions* options);
+
+/** Writes one line "key count" per key of t, in increasing order of the keys, in the file filename.
+ * The file is written under a temporary name then renamed, so a reader never sees a partial snapshot.
+ * @return true if the snapshot was written.
+ */
+bool ingest_snapshot(const BinarySearchTree* t, const char* filename);
+
+/** @} */
+
+#endif
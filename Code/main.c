@@ -1,7 +1,9 @@
 
 #include "bstree.h"
+#include "ingest.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /* Define this for solving the exercice 1 - coloring the tree. */
@@ -27,7 +29,7 @@
  */
 void print_tree(const BinarySearchTree *t, void *userData) {
     (void) userData;
-    printf("%d ", bstree_key(t));
+    printf("%" BSTREE_KEY_FORMAT " ", bstree_key(t));
 }
 
 /** This function reads an int from a file with result checking */
@@ -41,6 +43,20 @@ int read_int(FILE* input) {
   abort();
 }
 
+/** This function reads a key, an integer or a composite key "high:low", from a file with result checking */
+BSTreeKey read_key(FILE* input) {
+  char text[64];
+  BSTreeKey v;
+  if (fscanf(input, "%63s", text) == 1) {
+    const char* end = bstree_key_parse(text, &v);
+    if (end && *end == '\0') {
+      return v;
+    }
+  }
+  fprintf(stderr, "Unable to read a key from input file\n");
+  abort();
+}
+
 
 #ifndef EXERCICE_1
 /**
@@ -63,24 +79,24 @@ int read_int(FILE* input) {
 void node_to_dot(const BinarySearchTree *t, void *stream) {
     FILE *file = (FILE *) stream;
 
-    printf("%d ", bstree_key(t));
-    fprintf(file, "\tn%d [label=\"{%d|{<left>|<right>}}\"];\n",
+    printf("%" BSTREE_KEY_FORMAT " ", bstree_key(t));
+    fprintf(file, "\tn%" BSTREE_KEY_FORMAT " [label=\"{%" BSTREE_KEY_FORMAT "|{<left>|<right>}}\"];\n",
             bstree_key(t), bstree_key(t));
 
     if (bstree_left(t)) {
-        fprintf(file, "\tn%d:left:c -> n%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":left:c -> n%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(bstree_left(t)));
     } else {
-        fprintf(file, "\tlnil%d [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
-        fprintf(file, "\tn%d:left:c -> lnil%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\tlnil%" BSTREE_KEY_FORMAT " [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":left:c -> lnil%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(t));
     }
     if (bstree_right(t)) {
-        fprintf(file, "\tn%d:right:c -> n%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":right:c -> n%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(bstree_right(t)));
     } else {
-        fprintf(file, "\trnil%d [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
-        fprintf(file, "\tn%d:right:c -> rnil%d:n [headclip=false, tailclip=false]\n",
+        fprintf(file, "\trnil%" BSTREE_KEY_FORMAT " [style=filled, fillcolor=grey, label=\"NIL\"];\n", bstree_key(t));
+        fprintf(file, "\tn%" BSTREE_KEY_FORMAT ":right:c -> rnil%" BSTREE_KEY_FORMAT ":n [headclip=false, tailclip=false]\n",
                 bstree_key(t), bstree_key(t));
     }
 }
@@ -98,27 +114,98 @@ void export_dot(BinarySearchTree* t, FILE* stream) {
     fprintf(stream, "\n}\n");
 }
 
+/** Streaming mode of the test program.
+ * usage : bstreetest --stream [filename|-] [--report seconds] [--snapshot filename] [--wal filename]
+ *
+ * Keys are read from the file (a FIFO can be used) or from the standard input until the end of the stream.
+ * No count of the values is expected. Statistics are reported periodically on the standard error and, if
+ * requested, the tree is dumped in the snapshot file at each report.
+ *
+ * With --wal, the keys are recorded in a write-ahead log before being added to the tree. The tree is first
+ * recovered from the snapshot and the log left by a previous run, and each snapshot is a checkpoint of the log.
+ */
+int stream_main(int argc, char **argv) {
+    IngestOptions options;
+    ingest_default_options(&options);
+    FILE *input = stdin;
+    const char *wal = NULL;
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            options.report_interval = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            options.snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--wal") == 0 && i + 1 < argc) {
+            wal = argv[++i];
+        } else if (strcmp(argv[i], "-") == 0) {
+            input = stdin;
+        } else if (input == stdin) {
+            input = fopen(argv[i], "r");
+            if (!input) {
+                perror(argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage : %s --stream [filename|-] [--report seconds] [--snapshot filename] [--wal filename]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    BinarySearchTree *theTree = bstree_create();
+    if (wal) {
+        WalRecovery recovery = wal_recover(options.snapshot, wal, &theTree, true);
+        printf("Recovered %llu keys from the snapshot and %llu operations from the log%s in %.3f s.\n",
+               recovery.snapshot_keys, recovery.replayed, recovery.truncated ? " (incomplete last record)" : "",
+               recovery.seconds);
+        options.log = wal_open(wal, recovery.generation, NULL);
+        if (!options.log) {
+            perror(wal);
+            bstree_delete(&theTree);
+            return 1;
+        }
+    }
+    IngestStats stats = ingest_stream(input, &theTree, &options);
+    printf("Ingested %llu keys, %llu distinct, %llu ignored, in %.3f s (%.0f keys/s).\n", stats.keys, stats.distinct,
+           stats.ignored, stats.seconds, stats.seconds > 0 ? stats.keys / stats.seconds : 0.);
+
+    if (options.log) {
+        printf("Log committed in %llu groups.\n", wal_groups(options.log));
+        wal_close(&options.log);
+    }
+    bstree_delete(&theTree);
+    if (input != stdin)
+        fclose(input);
+    return 0;
+}
+
 /** Main function for testing the Tree implementation.
  * The main function expects one parameter that is the file where values added to the tree, searched into the
  * tree and removed from the tree are to be read.
  *
  * This file must contain the following informations :
  * - on the first line, the number of values to be added to the tree,
- * - on the second line, the values to be added, separated by a space (or tab).
+ * - on the second line, the values to be added, separated by a space (or tab). A value is an integer or a
+ *   composite key "high:low", see bstree_key_parse.
  * - on the third line, the number of values to be searched into the tree.
  * - on the fourth line, the values to be searched, separated by a space (or tab).
  * - on the fifth line, the number of values to be removed from the tree.
  * - on the sixth line, the values to be removed, separated by a space (or tab).
  *
  * The values will be added, searched and remove in the order they are read from the file.
+ *
+ * With --stream as first parameter, the program runs in streaming mode, see stream_main.
  */
 int main(int argc, char **argv) {
 
     if (argc < 2) {
-        fprintf(stderr, "usage : %s filename\n", argv[0]);
+        fprintf(stderr, "usage : %s filename\n       %s --stream [filename|-] [--report seconds] [--snapshot filename] [--wal filename]\n", argv[0], argv[0]);
         return 1;
     }
 
+    if (strcmp(argv[1], "--stream") == 0) {
+        return stream_main(argc, argv);
+    }
+
     FILE *input = fopen(argv[1], "r");
 
     if (!input) {
@@ -134,8 +221,8 @@ int main(int argc, char **argv) {
     int n = read_int(input);
 
     for (int i = 0; i < n; ++i) {
-        int v = read_int(input);
-        printf("%d ", v);
+        BSTreeKey v = read_key(input);
+        printf("%" BSTREE_KEY_FORMAT " ", v);
         bstree_add(&theTree, v);
     }
     printf("\nDone.\n");
@@ -150,7 +237,7 @@ int main(int argc, char **argv) {
 
 #ifdef EXERCICE_2
     /* Exercice 2 : rotate left */
-    printf("Rotating the tree left around %d.\n\t", bstree_key(theTree));
+    printf("Rotating the tree left around %" BSTREE_KEY_FORMAT ".\n\t", bstree_key(theTree));
     testrotateleft(theTree);
     theTree = bstree_parent(theTree);
     output = fopen("redblacktree_0_leftrotateroot.dot", "w");
@@ -158,7 +245,7 @@ int main(int argc, char **argv) {
     fclose(output);
     printf("Done.\n");
 
-    printf("Rotating the tree right around %d.\n\t", bstree_key(bstree_left(theTree)));
+    printf("Rotating the tree right around %" BSTREE_KEY_FORMAT ".\n\t", bstree_key(bstree_left(theTree)));
     testrotateright(bstree_left(theTree));
     output = fopen("redblacktree_0_rightrotateleftrotatedroot.dot", "w");
     export_dot(theTree, output);
@@ -171,8 +258,8 @@ int main(int argc, char **argv) {
     printf("Searching into the tree.");
     n = read_int(input);
     for (int i = 0; i < n; ++i) {
-        int v = read_int(input);
-        printf("\n\tSearching for value %d in the tree : %s", v, bstree_search(theTree, v) ? "true" : "false");
+        BSTreeKey v = read_key(input);
+        printf("\n\tSearching for value %" BSTREE_KEY_FORMAT " in the tree : %s", v, bstree_search(theTree, v) ? "true" : "false");
     }
     printf("\nDone.\n");
 
@@ -181,8 +268,8 @@ int main(int argc, char **argv) {
     printf("Removing from the tree."); 
     n = read_int(input);
     for (int i = 0; i < n; ++i) {
-        int v = read_int(input);
-        printf("\n\tRemoving the value %d from the tree : \t", v);
+        BSTreeKey v = read_key(input);
+        printf("\n\tRemoving the value %" BSTREE_KEY_FORMAT " from the tree : \t", v);
         bstree_remove(&theTree, v);
 
         char filename[256];
@@ -0,0 +1,252 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Pool allocator for fixed size elements, such as the nodes of a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "nodepool.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Size of the huge pages */
+#define HUGE_PAGE (2u << 20)
+
+/* A chunk of elements, chunks are linked so that they can be freed with the pool */
+typedef struct s_chunk {
+    struct s_chunk* next;
+    /* size of the mapping, 0 if the chunk was allocated with malloc */
+    size_t mapped;
+} Chunk;
+
+/* A released element, linked in the free list */
+typedef struct s_freeElement {
+    struct s_freeElement* next;
+} FreeElement;
+
+struct s_nodepool {
+    NodePoolOptions options;
+    size_t element_size;
+    size_t chunk_elements;
+    NodePoolStats stats;
+    Chunk* chunks;
+    FreeElement* free_list;
+    /* next never allocated element of the last chunk, and the end of this chunk */
+    char* fresh;
+    char* fresh_end;
+    size_t used;
+};
+
+/* Elements are aligned as pointers, which is enough for the nodes of a tree */
+static size_t align(size_t size) {
+    size_t a = sizeof(void*);
+    return (size + a - 1) / a * a;
+}
+
+void nodepool_default_options(NodePoolOptions* options) {
+    options->element_size = bstree_node_size();
+    options->chunk_elements = 4096;
+    options->pages = pages_default;
+    options->placement = placement_default;
+    options->node = 0;
+}
+
+NodePool* nodepool_create_with_options(const NodePoolOptions* options) {
+    NodePool* p = calloc(1, sizeof(NodePool));
+    p->options = *options;
+    p->element_size = align(options->element_size < sizeof(FreeElement) ? sizeof(FreeElement) : options->element_size);
+    p->chunk_elements = options->chunk_elements ? options->chunk_elements : 1;
+    if (options->pages != pages_default) {
+        /* whole huge pages : the rounding gives more elements to the chunk */
+        size_t bytes = align(sizeof(Chunk)) + p->chunk_elements * p->element_size;
+        bytes = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        p->chunk_elements = (bytes - align(sizeof(Chunk))) / p->element_size;
+    }
+    return p;
+}
+
+NodePool* nodepool_create(size_t element_size, size_t chunk_elements) {
+    NodePoolOptions options;
+    nodepool_default_options(&options);
+    options.element_size = element_size;
+    options.chunk_elements = chunk_elements;
+    return nodepool_create_with_options(&options);
+}
+
+#ifdef __linux__
+/* Mask of the online NUMA nodes, node 0 only if it cannot be read */
+static unsigned long online_nodes(void) {
+    unsigned long mask = 0;
+    FILE* f = fopen("/sys/devices/system/node/online", "r");
+    if (f) {
+        /* list of ranges, such as "0-1,4" */
+        int first, last;
+        while (fscanf(f, "%d", &first) == 1) {
+            last = first;
+            int separator = fgetc(f);
+            if (separator == '-' && fscanf(f, "%d", &last) == 1)
+                separator = fgetc(f);
+            for (int n = first; n <= last && n < (int)(8 * sizeof(mask)); ++n)
+                mask |= 1ul << n;
+            if (separator != ',')
+                break;
+        }
+        fclose(f);
+    }
+    return mask ? mask : 1ul;
+}
+
+/* Applies the NUMA placement to a fresh mapping, before its pages are touched */
+static bool place(const NodePool* p, void* memory, size_t bytes) {
+    unsigned long mask = 0;
+    int mode;
+    switch (p->options.placement) {
+        case placement_local:
+            mode = MPOL_LOCAL;
+            break;
+        case placement_interleave:
+            mode = MPOL_INTERLEAVE;
+            mask = online_nodes();
+            break;
+        case placement_node:
+            if (p->options.node < 0 || p->options.node >= (int)(8 * sizeof(mask)))
+                return false;
+            mode = MPOL_BIND;
+            mask = 1ul << p->options.node;
+            break;
+        default:
+            return false;
+    }
+    return syscall(SYS_mbind, memory, bytes, mode, mask ? &mask : NULL, mask ? 8 * sizeof(mask) : 0, 0) == 0;
+}
+
+/* Maps a chunk of bytes, a multiple of HUGE_PAGE, with the pages of the pool. Returns NULL on failure. */
+static void* map_chunk(NodePool* p, size_t bytes) {
+    void* memory = MAP_FAILED;
+    if (p->options.pages == pages_huge) {
+        memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED)
+            p->stats.huge_bytes += bytes;
+    }
+    if (memory == MAP_FAILED) {
+        /* over-allocate by one huge page and trim both ends so that the chunk is aligned for the kernel */
+        char* raw = mmap(NULL, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return NULL;
+        char* aligned = (char*)(((size_t)raw + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE);
+        if (aligned > raw)
+            munmap(raw, aligned - raw);
+        munmap(aligned + bytes, raw + HUGE_PAGE - aligned);
+        memory = aligned;
+        if (madvise(memory, bytes, MADV_HUGEPAGE) == 0)
+            p->stats.transparent_bytes += bytes;
+    }
+    if (place(p, memory, bytes))
+        p->stats.placed_bytes += bytes;
+    return memory;
+}
+#endif
+
+/* Allocates a chunk of bytes and records its size, mapping the pages requested by the options when possible */
+static Chunk* allocate_chunk(NodePool* p, size_t bytes) {
+    Chunk* c = NULL;
+    size_t mapped = 0;
+#ifdef __linux__
+    if (p->options.pages != pages_default) {
+        mapped = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        c = map_chunk(p, mapped);
+    }
+    else if (p->options.placement != placement_default) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        mapped = (bytes + page - 1) / page * page;
+        c = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c == MAP_FAILED)
+            c = NULL;
+        else if (place(p, c, mapped))
+            p->stats.placed_bytes += mapped;
+    }
+#endif
+    if (!c) {
+        mapped = 0;
+        c = malloc(bytes);
+    }
+    c->mapped = mapped;
+    p->stats.bytes += mapped ? mapped : bytes;
+    return c;
+}
+
+void nodepool_delete(ptrNodePool* p) {
+    Chunk* c = (*p)->chunks;
+    while (c) {
+        Chunk* next = c->next;
+#ifdef __linux__
+        if (c->mapped)
+            munmap(c, c->mapped);
+        else
+#endif
+            free(c);
+        c = next;
+    }
+    free(*p);
+    *p = NULL;
+}
+
+void* nodepool_alloc(NodePool* p) {
+    void* element;
+    if (p->free_list) {
+        element = p->free_list;
+        p->free_list = p->free_list->next;
+    } else {
+        if (p->fresh == p->fresh_end) {
+            Chunk* c = allocate_chunk(p, align(sizeof(Chunk)) + p->chunk_elements * p->element_size);
+            c->next = p->chunks;
+            p->chunks = c;
+            p->fresh = (char*)c + align(sizeof(Chunk));
+            p->fresh_end = p->fresh + p->chunk_elements * p->element_size;
+        }
+        element = p->fresh;
+        p->fresh += p->element_size;
+    }
+    ++p->used;
+    return element;
+}
+
+void nodepool_free(NodePool* p, void* element) {
+    assert(p->used > 0);
+    FreeElement* f = element;
+    f->next = p->free_list;
+    p->free_list = f;
+    --p->used;
+}
+
+size_t nodepool_used(const NodePool* p) {
+    return p->used;
+}
+
+NodePoolStats nodepool_stats(const NodePool* p) {
+    return p->stats;
+}
+
+static void* pool_allocate(size_t size, void* context) {
+    NodePool* p = context;
+    assert(size <= p->element_size);
+    (void)size;
+    return nodepool_alloc(p);
+}
+
+static void pool_release(void* node, void* context) {
+    nodepool_free(context, node);
+}
+
+BSTreeAllocator nodepool_allocator(NodePool* p) {
+    BSTreeAllocator allocator = { pool_allocate, pool_release, p };
+    return allocator;
+}
@@ -0,0 +1,112 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Pool allocator for fixed size elements, such as the nodes of a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __NODEPOOL__H__
+#define __NODEPOOL__H__
+#include <stddef.h>
+#include "bstree.h"
+
+/** \defgroup NodePool Pool allocator of tree nodes.
+ * @{
+ * A NodePool allocates its elements by chunks and recycles the released ones through a free list. Elements of
+ * a pool are contiguous in memory and the pool can be used by one tree without contention with the allocations
+ * of other threads. A pool is not thread safe : it must be protected by the lock of the tree using it.
+ *
+ * For large trees, the chunks can be backed by 2 MB huge pages, so that a random descent in the tree misses the
+ * TLB less often, and placed on chosen NUMA nodes. These options are only effective on Linux, the pool falls back
+ * to the standard pages and placement when the system cannot provide them.
+ */
+
+/** Pages backing the chunks of a pool. */
+typedef enum {
+    pages_default,     /**< chunks allocated with malloc. */
+    pages_transparent, /**< chunks aligned on 2 MB and advised as transparent huge pages (madvise), which the
+                            kernel provides when it can. */
+    pages_huge         /**< chunks in 2 MB huge pages reserved by the administrator (MAP_HUGETLB, see
+                            /proc/sys/vm/nr_hugepages), pages_transparent when no reserved page is left. */
+} NodePoolPages;
+
+/** NUMA placement of the chunks of a pool. */
+typedef enum {
+    placement_default,    /**< policy of the process, usually on the node of the thread touching the memory. */
+    placement_local,      /**< on the node of the thread allocating the chunk. */
+    placement_interleave, /**< pages interleaved on all the nodes, for a tree used by threads of every socket. */
+    placement_node        /**< on the node given in the options. */
+} NodePoolPlacement;
+
+/** Options of a pool. */
+typedef struct {
+    /** size of the elements, bstree_node_size() by default. */
+    size_t element_size;
+    /** number of elements of a chunk, rounded up to fill whole huge pages, 4096 by default. */
+    size_t chunk_elements;
+    /** pages of the chunks, pages_default by default. */
+    NodePoolPages pages;
+    /** NUMA placement of the chunks, placement_default by default. */
+    NodePoolPlacement placement;
+    /** node used by placement_node. */
+    int node;
+} NodePoolOptions;
+
+/** Memory obtained by a pool. */
+typedef struct {
+    /** bytes of all the chunks. */
+    size_t bytes;
+    /** bytes in reserved huge pages. */
+    size_t huge_bytes;
+    /** bytes advised as transparent huge pages. */
+    size_t transparent_bytes;
+    /** bytes whose requested NUMA placement was accepted by the system. */
+    size_t placed_bytes;
+} NodePoolStats;
+
+/** Opaque definition of the type NodePool */
+typedef struct s_nodepool NodePool;
+typedef NodePool* ptrNodePool;
+
+/** Constructor : builds an empty pool of elements of element_size bytes, allocated by chunks of
+ * chunk_elements elements.
+ */
+NodePool* nodepool_create(size_t element_size, size_t chunk_elements);
+
+/** Constructor : fills the options with default values.
+ */
+void nodepool_default_options(NodePoolOptions* options);
+
+/** Constructor : builds an empty pool with the given options.
+ */
+NodePool* nodepool_create_with_options(const NodePoolOptions* options);
+
+/** Destructor : delete the pool and all the elements allocated from it.
+ */
+void nodepool_delete(ptrNodePool* p);
+
+/** Operator : allocate an element from the pool.
+ */
+void* nodepool_alloc(NodePool* p);
+
+/** Operator : give an element back to the pool.
+ */
+void nodepool_free(NodePool* p, void* element);
+
+/** Operator : number of elements currently allocated from the pool.
+ */
+size_t nodepool_used(const NodePool* p);
+
+/** Operator : memory obtained by the pool, to know which of the requested options were applied.
+ */
+NodePoolStats nodepool_stats(const NodePool* p);
+
+/** Operator : an allocator for BSTreeOptions that takes the nodes from the pool.
+ * @pre the element size of the pool is at least the size of the nodes of the tree, bstree_node_size() or
+ * bstree_options_node_size() for a managed tree.
+ */
+BSTreeAllocator nodepool_allocator(NodePool* p);
+
+/** @} */
+
+#endif
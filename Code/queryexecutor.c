@@ -0,0 +1,128 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Batched execution of independent queries on a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#include "queryexecutor.h"
+#include <assert.h>
+#include <stdlib.h>
+
+/* Loads a node in the cache without waiting for it. Prefetching NULL is harmless. */
+#if defined(__GNUC__)
+#define prefetch(x) __builtin_prefetch(x)
+#else
+#define prefetch(x) ((void)(x))
+#endif
+
+typedef enum {
+    /* going down the tree, towards the key of a point query or the first key of a range query */
+    slot_descent,
+    /* going from successor to successor through the keys of a range query */
+    slot_scan
+} SlotState;
+
+/* A query in flight, resumed at each round from where it stopped */
+typedef struct {
+    size_t query;
+    SlotState state;
+    /* the next node to examine, prefetched when the query stopped */
+    const BinarySearchTree* cursor;
+    /* for a range query, the smallest node >= low seen during the descent */
+    const BinarySearchTree* first;
+} Slot;
+
+struct s_queryexecutor {
+    Slot* slots;
+    size_t inflight;
+};
+
+QueryExecutor* executor_create(size_t inflight) {
+    assert(inflight > 0);
+    QueryExecutor* e = malloc(sizeof(QueryExecutor));
+    e->slots = malloc(inflight * sizeof(Slot));
+    e->inflight = inflight;
+    return e;
+}
+
+void executor_delete(ptrQueryExecutor* e) {
+    free((*e)->slots);
+    free(*e);
+    *e = NULL;
+}
+
+size_t executor_inflight(const QueryExecutor* e) {
+    return e->inflight;
+}
+
+static void start(Slot* s, const BinarySearchTree* t, size_t query) {
+    s->query = query;
+    s->state = slot_descent;
+    s->cursor = t;
+    s->first = NULL;
+    prefetch(t);
+}
+
+/* Examines the next node of the query of the slot and prefetches the following one.
+ * Returns false when the query is finished.
+ */
+static bool step(Slot* s, const TreeQuery* q, QueryFunctor f, void* environment) {
+    const BinarySearchTree* x = s->cursor;
+    if (s->state == slot_descent) {
+        if (bstree_empty(x)) {
+            if (q->kind == query_point) {
+                f(s->query, NULL, environment);
+                return false;
+            }
+            /* the first node of the range was examined during the descent, it is still in the cache */
+            s->state = slot_scan;
+            x = s->first;
+        }
+        else {
+            BSTreeKey key = bstree_key(x);
+            if (q->kind == query_point && key == q->low) {
+                f(s->query, x, environment);
+                return false;
+            }
+            if (q->kind == query_range && key >= q->low)
+                s->first = x;
+            /* a range query goes left from its first key, to find a smaller one >= low */
+            s->cursor = q->low <= key ? bstree_left(x) : bstree_right(x);
+            if (q->kind == query_point || key != q->low) {
+                prefetch(s->cursor);
+                return true;
+            }
+            s->state = slot_scan;
+        }
+    }
+    if (bstree_empty(x) || bstree_key(x) > q->high)
+        return false;
+    f(s->query, x, environment);
+    s->cursor = bstree_successor(x);
+    prefetch(s->cursor);
+    return true;
+}
+
+void executor_run(QueryExecutor* e, const BinarySearchTree* t, const TreeQuery* queries, size_t nb, QueryFunctor f, void* environment) {
+    size_t next = 0;
+    size_t active = 0;
+    while (active < e->inflight && next < nb)
+        start(&e->slots[active++], t, next++);
+
+    /* Round robin over the queries in flight : a finished query is replaced by the next one of the batch, or by
+     * the last query in flight when the batch is exhausted. */
+    while (active > 0) {
+        for (size_t i = 0; i < active;) {
+            Slot* s = &e->slots[i];
+            if (step(s, &queries[s->query], f, environment))
+                ++i;
+            else if (next < nb) {
+                start(s, t, next++);
+                ++i;
+            }
+            else
+                *s = e->slots[--active];
+        }
+    }
+}
@@ -0,0 +1,74 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Batched execution of independent queries on a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __QUERYEXECUTOR__H__
+#define __QUERYEXECUTOR__H__
+#include "bstree.h"
+
+/** \defgroup QueryExecutor Interleaved execution of a batch of queries.
+ * @{
+ * A search in a large tree waits for a cache miss at almost every level, and a loop of searches waits for them one
+ * after the other. A QueryExecutor runs many queries of a batch at once : each query in flight is a small state
+ * machine that examines one node, prefetches the next one and lets the other queries run while the node is
+ * loaded. The cache misses of the queries in flight overlap instead of adding up.
+ *
+ * A point query is answered by a single call of the functor, with the node of the key or NULL. A range query
+ * [low, high] descends to its first key then visits its successors, the functor is called once for each node
+ * in the range, in increasing order of the keys. The calls for different queries are interleaved.
+ *
+ * An executor is used by one thread at a time, several threads use one executor each.
+ */
+
+/** Kind of a query. */
+typedef enum {
+    query_point, /**< search for the key low. */
+    query_range  /**< visit of the keys in [low, high]. */
+} QueryKind;
+
+/** A query of a batch. */
+typedef struct {
+    QueryKind kind;
+    /** the key searched by a point query, the lowest key of a range query. */
+    BSTreeKey low;
+    /** the highest key of a range query, unused by a point query. */
+    BSTreeKey high;
+} TreeQuery;
+
+/** Functor receiving the results of the queries : the index of the query in the batch and a node of the tree,
+ * NULL for a point query whose key is not in the tree. It must not modify the tree.
+ */
+typedef void(*QueryFunctor)(size_t query, const BinarySearchTree* node, void* environment);
+
+/** Opaque definition of the type QueryExecutor */
+typedef struct s_queryexecutor QueryExecutor;
+typedef QueryExecutor* ptrQueryExecutor;
+
+/** Constructor : builds an executor running up to inflight queries at once.
+ * Enough queries to cover the latency of a cache miss are needed, 16 to 32 on current processors.
+ * @param inflight number of queries in flight, at least 1.
+ */
+QueryExecutor* executor_create(size_t inflight);
+
+/** Destructor : delete the executor.
+ */
+void executor_delete(ptrQueryExecutor* e);
+
+/** Operator : number of queries run at once.
+ */
+size_t executor_inflight(const QueryExecutor* e);
+
+/** Visitor : runs the queries of the batch on t and reports their results to f.
+ * The queries start in the order of the batch, but finish in any order. The executor does not allocate.
+ * @param queries the batch of nb queries.
+ * @param f the functor receiving the results.
+ * @param environment user defined environment to forward to the functor.
+ */
+void executor_run(QueryExecutor* e, const BinarySearchTree* t, const TreeQuery* queries, size_t nb, QueryFunctor f, void* environment);
+
+/** @} */
+
+#endif
@@ -0,0 +1,253 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Range partitioned collection of BinarySearchTree, for concurrent writers.
+ */
+/*-----------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include "shardedtree.h"
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "nodepool.h"
+
+/* Number of nodes allocated at once by the pool of a shard */
+#define SHARD_POOL_CHUNK 4096
+/* A shard is hot when it holds more than twice the average number of keys plus this margin. After a rebalance,
+ * all the shards have the same size : the margin and the factor 2 make the next one wait for about total / nb_shards
+ * insertions in the same shard, so that its cost is amortized. */
+#define REBALANCE_MARGIN 1024
+
+typedef struct {
+    pthread_mutex_t lock;
+    /* smallest key of the range of the shard, the range ends where the one of the next shard begins */
+    BSTreeKey lower;
+    BSTreeHandle* tree;
+    NodePool* pool;
+    /* copy of the size of the tree, that can be read without taking the lock */
+    size_t size;
+} Shard;
+
+struct s_shardedtree {
+    /* taken for reading by all the operators, for writing when the shard boundaries move */
+    pthread_rwlock_t layout;
+    unsigned int nb_shards;
+    Shard* shards;
+    /* number of keys in all the shards, updated atomically */
+    size_t total;
+};
+
+ShardedTree* sharded_create(unsigned int nb_shards, bool multiset) {
+    assert(nb_shards > 0);
+    ShardedTree* st = malloc(sizeof(ShardedTree));
+    pthread_rwlock_init(&st->layout, NULL);
+    st->nb_shards = nb_shards;
+    st->shards = malloc(nb_shards * sizeof(Shard));
+    st->total = 0;
+
+    /* 2^bits / nb_shards, computed without overflow for 64 bits keys */
+    unsigned long long width = sizeof(BSTreeKey) > 4 ? ULLONG_MAX / nb_shards : ((unsigned long long)UINT_MAX + 1) / nb_shards;
+    for (unsigned int i = 0; i < nb_shards; ++i) {
+        Shard* s = &st->shards[i];
+        pthread_mutex_init(&s->lock, NULL);
+        s->lower = (BSTreeKey)((unsigned long long)BSTREE_KEY_MIN + width * i);
+        s->pool = nodepool_create(bstree_node_size(), SHARD_POOL_CHUNK);
+        BSTreeOptions options;
+        bstree_default_options(&options);
+        options.allocator = nodepool_allocator(s->pool);
+        options.multiset = multiset;
+        s->tree = bstree_handle_create(&options);
+        s->size = 0;
+    }
+    return st;
+}
+
+void sharded_delete(ptrShardedTree* st) {
+    for (unsigned int i = 0; i < (*st)->nb_shards; ++i) {
+        Shard* s = &(*st)->shards[i];
+        bstree_handle_delete(&s->tree);
+        nodepool_delete(&s->pool);
+        pthread_mutex_destroy(&s->lock);
+    }
+    pthread_rwlock_destroy(&(*st)->layout);
+    free((*st)->shards);
+    free(*st);
+    *st = NULL;
+}
+
+/* Index of the shard whose range contains v. The layout lock must be held. */
+static unsigned int find_shard(const ShardedTree* st, BSTreeKey v) {
+    unsigned int low = 0, high = st->nb_shards - 1;
+    while (low < high) {
+        unsigned int middle = (low + high + 1) / 2;
+        if (st->shards[middle].lower <= v)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+static void update_size(Shard* s) {
+    __atomic_store_n(&s->size, bstree_handle_size(s->tree), __ATOMIC_RELAXED);
+}
+
+static size_t shard_size(Shard* s) {
+    return __atomic_load_n(&s->size, __ATOMIC_RELAXED);
+}
+
+/* With fewer keys than shards, some shards stay empty whatever the boundaries : none is hot */
+static bool is_hot(ShardedTree* st, size_t size) {
+    size_t total = __atomic_load_n(&st->total, __ATOMIC_RELAXED);
+    return total >= st->nb_shards && size > 2 * (total / st->nb_shards) + REBALANCE_MARGIN;
+}
+
+bool sharded_add(ShardedTree* st, BSTreeKey v) {
+    pthread_rwlock_rdlock(&st->layout);
+    Shard* s = &st->shards[find_shard(st, v)];
+    pthread_mutex_lock(&s->lock);
+    bool added = bstree_handle_add(s->tree, v);
+    update_size(s);
+    pthread_mutex_unlock(&s->lock);
+    if (added)
+        __atomic_add_fetch(&st->total, 1, __ATOMIC_RELAXED);
+    bool hot = added && is_hot(st, shard_size(s));
+    pthread_rwlock_unlock(&st->layout);
+
+    if (hot)
+        sharded_rebalance(st);
+    return added;
+}
+
+bool sharded_remove(ShardedTree* st, BSTreeKey v) {
+    pthread_rwlock_rdlock(&st->layout);
+    Shard* s = &st->shards[find_shard(st, v)];
+    pthread_mutex_lock(&s->lock);
+    size_t before = bstree_handle_size(s->tree);
+    bool removed = bstree_handle_remove(s->tree, v);
+    update_size(s);
+    if (bstree_handle_size(s->tree) < before)
+        __atomic_sub_fetch(&st->total, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&s->lock);
+    pthread_rwlock_unlock(&st->layout);
+    return removed;
+}
+
+unsigned int sharded_count(ShardedTree* st, BSTreeKey v) {
+    pthread_rwlock_rdlock(&st->layout);
+    Shard* s = &st->shards[find_shard(st, v)];
+    pthread_mutex_lock(&s->lock);
+    unsigned int count = bstree_count(bstree_handle_root(s->tree), v);
+    pthread_mutex_unlock(&s->lock);
+    pthread_rwlock_unlock(&st->layout);
+    return count;
+}
+
+size_t sharded_size(ShardedTree* st) {
+    return __atomic_load_n(&st->total, __ATOMIC_RELAXED);
+}
+
+void sharded_visit(ShardedTree* st, OperateFunctor f, void* environment) {
+    pthread_rwlock_rdlock(&st->layout);
+    for (unsigned int i = 0; i < st->nb_shards; ++i) {
+        Shard* s = &st->shards[i];
+        pthread_mutex_lock(&s->lock);
+        bstree_depth_infix(bstree_handle_root(s->tree), f, environment);
+        pthread_mutex_unlock(&s->lock);
+    }
+    pthread_rwlock_unlock(&st->layout);
+}
+
+void sharded_range(ShardedTree* st, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment) {
+    if (low > high)
+        return;
+    pthread_rwlock_rdlock(&st->layout);
+    for (unsigned int i = find_shard(st, low); i < st->nb_shards && st->shards[i].lower <= high; ++i) {
+        Shard* s = &st->shards[i];
+        pthread_mutex_lock(&s->lock);
+        bstree_range(bstree_handle_root(s->tree), low, high, f, environment);
+        pthread_mutex_unlock(&s->lock);
+    }
+    pthread_rwlock_unlock(&st->layout);
+}
+
+/* Moves the nb smallest (to == from - 1) or largest (to == from + 1) keys of the shard from to its neighbour
+ * to, and moves the boundary between them accordingly. The layout lock must be held for writing.
+ * @pre the source keeps at least one key beyond the moved ones, so the new boundary does not overflow.
+ */
+static void move_keys(ShardedTree* st, unsigned int from, unsigned int to, size_t nb) {
+    Shard* source = &st->shards[from];
+    Shard* destination = &st->shards[to];
+    assert(nb < bstree_handle_size(source->tree));
+    BSTreeKey* keys = malloc(nb * sizeof(BSTreeKey));
+
+    BSTreeIterator* i = bstree_iterator_create(bstree_handle_root(source->tree), to < from ? forward : backward);
+    bstree_iterator_begin(i);
+    for (size_t k = 0; k < nb; ++k) {
+        keys[k] = bstree_key(bstree_iterator_value(i));
+        bstree_iterator_next(i);
+    }
+    bstree_iterator_delete(&i);
+
+    for (size_t k = 0; k < nb; ++k) {
+        unsigned int count = bstree_handle_remove_all(source->tree, keys[k]);
+        bstree_handle_add_occurrences(destination->tree, keys[k], count);
+    }
+    if (to < from)
+        source->lower = keys[nb - 1] + 1;
+    else
+        destination->lower = keys[nb - 1];
+
+    update_size(source);
+    update_size(destination);
+    free(keys);
+}
+
+void sharded_rebalance(ShardedTree* st) {
+    pthread_rwlock_wrlock(&st->layout);
+    unsigned int nb = st->nb_shards;
+    size_t total = 0;
+    bool hot = false;
+    for (unsigned int i = 0; i < nb; ++i) {
+        total += st->shards[i].size;
+        hot = hot || is_hot(st, st->shards[i].size);
+    }
+    /* another writer may have rebalanced since the caller saw a hot shard */
+    if (!hot) {
+        pthread_rwlock_unlock(&st->layout);
+        return;
+    }
+
+    /* Global split : the shard i receives the keys of rank [i * total / nb, (i + 1) * total / nb). The flow across
+     * the boundary after the shard i is the number of keys of the shards up to i beyond their share, positive to
+     * the right. The flows to the right are done from left to right and the flows to the left from right to left :
+     * a shard receives its keys before giving them away, and keeps at least its share, one key or more. */
+    long long* flows = malloc(nb * sizeof(long long));
+    size_t cumulated = 0;
+    for (unsigned int i = 0; i + 1 < nb; ++i) {
+        cumulated += st->shards[i].size;
+        flows[i] = (long long)cumulated - (long long)((i + 1) * (unsigned long long)total / nb);
+    }
+    for (unsigned int i = 0; i + 1 < nb; ++i) {
+        if (flows[i] > 0)
+            move_keys(st, i, i + 1, (size_t)flows[i]);
+    }
+    for (unsigned int i = nb - 1; i-- > 0;) {
+        if (flows[i] < 0)
+            move_keys(st, i + 1, i, (size_t)-flows[i]);
+    }
+    free(flows);
+    pthread_rwlock_unlock(&st->layout);
+}
+
+unsigned int sharded_nb_shards(const ShardedTree* st) {
+    return st->nb_shards;
+}
+
+size_t sharded_shard_size(ShardedTree* st, unsigned int i) {
+    assert(i < st->nb_shards);
+    return shard_size(&st->shards[i]);
+}
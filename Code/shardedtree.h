@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Range partitioned collection of BinarySearchTree, for concurrent writers.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __SHARDEDTREE__H__
+#define __SHARDEDTREE__H__
+#include "bstree.h"
+
+/** \defgroup ShardedTree Range sharded trees.
+ * @{
+ * A ShardedTree partitions the key space into contiguous ranges, each one stored in an independent red-black
+ * tree (a shard) with its own lock and its own node pool. Writers on different shards do not contend. As the
+ * shards are ordered by key range, an ordered visit or a range query is the concatenation of the visits of the
+ * shards.
+ *
+ * When a shard becomes much bigger than the average, all the boundaries are moved so that the shards hold the same
+ * number of keys, and the keys are transferred between neighbours. Skewed key distributions, such as increasing
+ * identifiers, still spread over all the shards.
+ *
+ * All the operators are thread safe.
+ */
+
+/** Opaque definition of the type ShardedTree */
+typedef struct s_shardedtree ShardedTree;
+typedef ShardedTree* ptrShardedTree;
+
+/** Constructor : builds an empty sharded tree with nb_shards shards evenly spread over the range of the keys.
+ * @param nb_shards the number of shards, at least 1.
+ * @param multiset if true, the shards count the occurrences of their keys, see BSTreeOptions::multiset.
+ */
+ShardedTree* sharded_create(unsigned int nb_shards, bool multiset);
+
+/** Destructor : delete the sharded tree.
+ * @pre no other thread uses the tree.
+ */
+void sharded_delete(ptrShardedTree* st);
+
+/** Constructor : add a value to the sharded tree.
+ * @return true if the value was not yet in the tree.
+ */
+bool sharded_add(ShardedTree* st, BSTreeKey v);
+
+/** Operator : remove a value, or one of its occurrences for a multiset, from the sharded tree.
+ * @return true if the value was in the tree.
+ */
+bool sharded_remove(ShardedTree* st, BSTreeKey v);
+
+/** Operator : number of occurrences of v in the tree (0 or 1 if the tree is not a multiset).
+ */
+unsigned int sharded_count(ShardedTree* st, BSTreeKey v);
+
+/** Operator : number of distinct keys in the tree.
+ */
+size_t sharded_size(ShardedTree* st);
+
+/** Visitor : infix visit of all the keys of the tree, in increasing order.
+ * Each shard is locked during its own visit only : the visit is consistent shard by shard.
+ * The functor must not modify the sharded tree.
+ */
+void sharded_visit(ShardedTree* st, OperateFunctor f, void* environment);
+
+/** Visitor : infix visit of the keys in [low, high], in increasing order. Only the shards whose range
+ * intersects [low, high] are locked and visited.
+ * The functor must not modify the sharded tree.
+ */
+void sharded_range(ShardedTree* st, BSTreeKey low, BSTreeKey high, OperateFunctor f, void* environment);
+
+/** Operator : if a shard is more than twice as big as the average, move the shard boundaries so that all the shards
+ * hold the same number of keys, within one. Each key moved costs a removal and an insertion.
+ * This is done automatically by sharded_add, it may be called explicitly after bulk removals.
+ */
+void sharded_rebalance(ShardedTree* st);
+
+/** Operator : number of shards of the tree.
+ */
+unsigned int sharded_nb_shards(const ShardedTree* st);
+
+/** Operator : number of distinct keys in the shard i.
+ */
+size_t sharded_shard_size(ShardedTree* st, unsigned int i);
+
+/** @} */
+
+#endif
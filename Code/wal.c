@@ -0,0 +1,537 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Write-ahead log of the mutations of a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#include "wal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* First bytes of a log file, which differ with the size of the keys */
+#ifdef BSTREE_KEY64
+static const char wal_magic[8] = { 'B', 'S', 'T', 'W', 'A', 'L', '6', '4' };
+typedef int64_t WalKey;
+#else
+static const char wal_magic[8] = { 'B', 'S', 'T', 'W', 'A', 'L', '0', '1' };
+typedef int32_t WalKey;
+#endif
+
+/* Size in records of the chunks read when a log is scanned */
+#define SCAN_CHUNK 4096
+
+typedef struct {
+    char magic[8];
+    /* the log contains the operations done after the snapshot of the same generation */
+    uint64_t generation;
+} WalHeader;
+
+typedef enum { record_add = 1, record_remove = 2 } RecordType;
+
+/* One logged operation. The check field detects a record partially written by a crash. */
+typedef struct {
+    WalKey key;
+    uint8_t type;
+    uint8_t unused;
+    uint16_t check;
+#ifdef BSTREE_KEY64
+    /* the padding of the record, written as zeros */
+    uint32_t padding;
+#endif
+} WalRecord;
+
+struct s_wal {
+    /* the file is replaced at each checkpoint, see create_log */
+    char* filename;
+    int fd;
+    /* end of the records written in the file, only changed by the writer thread and the checkpoints */
+    off_t offset;
+    WalOptions options;
+    uint64_t generation;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    /* signals the writer thread that records are pending, that a sync is requested or that the log closes */
+    pthread_cond_t wake;
+    /* signals the producers and the waiters of wal_sync that the writer thread made progress */
+    pthread_cond_t done;
+    /* records are appended to the active buffer while the writer thread writes the other one */
+    WalRecord* buffers[2];
+    WalRecord* active;
+    size_t length;
+    /* number of records appended since the opening, and number of them flushed to the disk */
+    unsigned long long appended;
+    unsigned long long durable;
+    /* number of records appended since the last checkpoint */
+    unsigned long long records;
+    unsigned long long groups;
+    /* number of threads waiting in wal_sync, the writer thread does not wait for more records when positive */
+    unsigned int waiters;
+    bool writing;
+    bool closing;
+    /* first error of the writer thread, 0 if none */
+    int error;
+};
+
+void wal_default_options(WalOptions* options) {
+    options->flush_interval = 0.01;
+    options->buffer_records = 1 << 16;
+    options->sync = true;
+}
+
+/* Current time in seconds, from a monotonic clock */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint16_t record_check(WalKey key, uint8_t type) {
+    uint32_t folded = (uint32_t)key ^ (sizeof(WalKey) > 4 ? (uint32_t)((uint64_t)key >> 32) : 0u);
+    uint32_t x = folded * 0x9e3779b1u ^ type;
+    return (uint16_t)((x >> 16 ^ x) ^ 0xa5a5u);
+}
+
+static WalRecord make_record(BSTreeKey v, RecordType type) {
+    WalRecord r;
+    memset(&r, 0, sizeof(WalRecord));
+    r.key = v;
+    r.type = (uint8_t)type;
+    r.check = record_check(v, r.type);
+    return r;
+}
+
+static bool valid_record(const WalRecord* r) {
+    return (r->type == record_add || r->type == record_remove) && r->unused == 0 &&
+           r->check == record_check(r->key, r->type);
+}
+
+/* Writes the whole buffer at the given offset, returns 0 or the errno of the failure */
+static int write_all(int fd, const void* buffer, size_t length, off_t offset) {
+    const char* bytes = buffer;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        bytes += written;
+        offset += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Reads the header of the log then calls apply on each valid record, in order, until the end of the file or the
+ * first invalid record. Returns the length of the valid part of the log, or -1 if it has no valid header.
+ */
+static off_t scan_log(int fd, WalHeader* header, void (*apply)(const WalRecord*, void*), void* env,
+                      bool* truncated) {
+    *truncated = false;
+    if (pread(fd, header, sizeof(WalHeader), 0) != (ssize_t)sizeof(WalHeader) ||
+        memcmp(header->magic, wal_magic, sizeof(wal_magic)) != 0)
+        return -1;
+
+    WalRecord* chunk = malloc(SCAN_CHUNK * sizeof(WalRecord));
+    off_t offset = sizeof(WalHeader);
+    ssize_t length;
+    while ((length = pread(fd, chunk, SCAN_CHUNK * sizeof(WalRecord), offset)) != 0) {
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        size_t nb = (size_t)length / sizeof(WalRecord);
+        for (size_t i = 0; i < nb; ++i) {
+            if (!valid_record(&chunk[i])) {
+                *truncated = true;
+                free(chunk);
+                return offset;
+            }
+            if (apply)
+                apply(&chunk[i], env);
+            offset += sizeof(WalRecord);
+        }
+        if ((size_t)length % sizeof(WalRecord) != 0) {
+            *truncated = true;
+            break;
+        }
+    }
+    free(chunk);
+    return offset;
+}
+
+/* Flushes the directory containing filename, so that a rename in it is durable */
+static bool sync_directory(const char* filename) {
+    char directory[4096];
+    const char* slash = strrchr(filename, '/');
+    if (!slash)
+        strcpy(directory, ".");
+    else if ((size_t)(slash - filename) >= sizeof(directory)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    else if (slash == filename)
+        strcpy(directory, "/");
+    else {
+        memcpy(directory, filename, (size_t)(slash - filename));
+        directory[slash - filename] = '\0';
+    }
+    int fd = open(directory, O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+/* Replaces the log filename by an empty log of the given generation and returns its descriptor, or -1 with errno
+ * set. The header is written under a temporary name, flushed and renamed : a crash leaves either the previous log
+ * or the new one, never a log without header.
+ */
+static int create_log(const char* filename, uint64_t generation, bool sync) {
+    char temporary[4096];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", filename) >= (int)sizeof(temporary)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    WalHeader header;
+    memcpy(header.magic, wal_magic, sizeof(wal_magic));
+    header.generation = generation;
+    int error = write_all(fd, &header, sizeof(WalHeader), 0);
+    if (!error && sync && fdatasync(fd) != 0)
+        error = errno;
+    if (!error && rename(temporary, filename) != 0)
+        error = errno;
+    if (!error && sync && !sync_directory(filename))
+        error = errno;
+    if (error) {
+        close(fd);
+        unlink(temporary);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+/* Writer thread : collects the records logged during flush_interval, writes them and flushes them at once */
+static void* writer(void* env) {
+    WriteAheadLog* log = env;
+    pthread_mutex_lock(&log->lock);
+    for (;;) {
+        while (!log->closing && log->length == 0)
+            pthread_cond_wait(&log->wake, &log->lock);
+        if (log->length == 0)
+            break;
+
+        /* Group commit : let the group grow until the interval ends, unless someone waits for it */
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        double interval = log->options.flush_interval;
+        deadline.tv_sec += (time_t)interval;
+        deadline.tv_nsec += (long)((interval - (time_t)interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L) {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!log->closing && !log->waiters && log->length < log->options.buffer_records / 2 &&
+               pthread_cond_timedwait(&log->wake, &log->lock, &deadline) != ETIMEDOUT)
+            ;
+
+        WalRecord* group = log->active;
+        size_t nb = log->length;
+        int fd = log->fd;
+        off_t offset = log->offset;
+        unsigned long long last = log->appended;
+        log->active = group == log->buffers[0] ? log->buffers[1] : log->buffers[0];
+        log->length = 0;
+        log->writing = true;
+        /* producers blocked on a full buffer can go on with the other one */
+        pthread_cond_broadcast(&log->done);
+        pthread_mutex_unlock(&log->lock);
+
+        int error = write_all(fd, group, nb * sizeof(WalRecord), offset);
+        if (!error && log->options.sync && fdatasync(fd) != 0)
+            error = errno;
+
+        pthread_mutex_lock(&log->lock);
+        log->writing = false;
+        if (!error)
+            log->offset = offset + (off_t)(nb * sizeof(WalRecord));
+        else if (!log->error)
+            log->error = error;
+        log->durable = last;
+        ++log->groups;
+        pthread_cond_broadcast(&log->done);
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+WriteAheadLog* wal_open(const char* filename, unsigned long long generation, const WalOptions* options) {
+    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return NULL;
+
+    WalHeader header;
+    bool truncated;
+    off_t length = scan_log(fd, &header, NULL, NULL, &truncated);
+    int error = 0;
+    if (length < 0 && lseek(fd, 0, SEEK_END) != 0)
+        /* only an empty file is replaced, not a file that is not a log */
+        error = EINVAL;
+    else if (length < 0 || header.generation < generation) {
+        /* new log, or log older than the snapshot whose records are already in the snapshot */
+        close(fd);
+        fd = create_log(filename, generation, !options || options->sync);
+        if (fd < 0)
+            return NULL;
+        header.generation = generation;
+        length = sizeof(WalHeader);
+    }
+    else if (truncated && ftruncate(fd, length) != 0)
+        error = errno;
+    if (error) {
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+
+    WriteAheadLog* log = malloc(sizeof(WriteAheadLog));
+    log->filename = strdup(filename);
+    log->fd = fd;
+    log->offset = length;
+    if (options)
+        log->options = *options;
+    else
+        wal_default_options(&log->options);
+    if (log->options.buffer_records < 2)
+        log->options.buffer_records = 2;
+    log->generation = header.generation;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&log->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_cond_init(&log->done, NULL);
+    log->buffers[0] = malloc(log->options.buffer_records * sizeof(WalRecord));
+    log->buffers[1] = malloc(log->options.buffer_records * sizeof(WalRecord));
+    log->active = log->buffers[0];
+    log->length = 0;
+    log->appended = log->durable = 0;
+    log->records = 0;
+    log->groups = 0;
+    log->waiters = 0;
+    log->writing = false;
+    log->closing = false;
+    log->error = 0;
+    pthread_create(&log->writer, NULL, writer, log);
+    return log;
+}
+
+void wal_close(ptrWriteAheadLog* log) {
+    WriteAheadLog* l = *log;
+    pthread_mutex_lock(&l->lock);
+    l->closing = true;
+    pthread_cond_signal(&l->wake);
+    pthread_mutex_unlock(&l->lock);
+    pthread_join(l->writer, NULL);
+
+    close(l->fd);
+    pthread_cond_destroy(&l->wake);
+    pthread_cond_destroy(&l->done);
+    pthread_mutex_destroy(&l->lock);
+    free(l->buffers[0]);
+    free(l->buffers[1]);
+    free(l->filename);
+    free(l);
+    *log = NULL;
+}
+
+static void append(WriteAheadLog* log, BSTreeKey v, RecordType type) {
+    pthread_mutex_lock(&log->lock);
+    while (log->length == log->options.buffer_records) {
+        pthread_cond_signal(&log->wake);
+        pthread_cond_wait(&log->done, &log->lock);
+    }
+    log->active[log->length++] = make_record(v, type);
+    ++log->appended;
+    ++log->records;
+    /* the first record starts the group, reaching half the buffer ends it */
+    if (log->length == 1 || log->length == log->options.buffer_records / 2)
+        pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+}
+
+void wal_log_add(WriteAheadLog* log, BSTreeKey v) {
+    append(log, v, record_add);
+}
+
+void wal_log_remove(WriteAheadLog* log, BSTreeKey v) {
+    append(log, v, record_remove);
+}
+
+bool wal_sync(WriteAheadLog* log) {
+    pthread_mutex_lock(&log->lock);
+    unsigned long long target = log->appended;
+    ++log->waiters;
+    pthread_cond_signal(&log->wake);
+    while (log->durable < target && !log->error)
+        pthread_cond_wait(&log->done, &log->lock);
+    --log->waiters;
+    int error = log->error;
+    pthread_mutex_unlock(&log->lock);
+    if (error)
+        errno = error;
+    return !error;
+}
+
+unsigned long long wal_records(WriteAheadLog* log) {
+    pthread_mutex_lock(&log->lock);
+    unsigned long long records = log->records;
+    pthread_mutex_unlock(&log->lock);
+    return records;
+}
+
+unsigned long long wal_groups(WriteAheadLog* log) {
+    pthread_mutex_lock(&log->lock);
+    unsigned long long groups = log->groups;
+    pthread_mutex_unlock(&log->lock);
+    return groups;
+}
+
+/*------------------------  Snapshots  -----------------------------*/
+
+static void snapshot_node(const BinarySearchTree* t, void* stream) {
+    fprintf((FILE*)stream, "%" BSTREE_KEY_FORMAT " %u\n", bstree_key(t), bstree_multiplicity(t));
+}
+
+static bool write_snapshot(const BinarySearchTree* t, const char* filename, uint64_t generation, bool sync) {
+    char temporary[4096];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", filename) >= (int)sizeof(temporary))
+        return false;
+    FILE* output = fopen(temporary, "w");
+    if (!output)
+        return false;
+    fprintf(output, "generation %llu\n", (unsigned long long)generation);
+    bstree_depth_infix(t, snapshot_node, output);
+    bool written = fflush(output) == 0 && (!sync || fsync(fileno(output)) == 0);
+    if (fclose(output) != 0 || !written)
+        return false;
+    if (rename(temporary, filename) != 0)
+        return false;
+    return !sync || sync_directory(filename);
+}
+
+bool wal_checkpoint(WriteAheadLog* log, const BinarySearchTree* t, const char* snapshot) {
+    if (!wal_sync(log))
+        return false;
+    /* The snapshot contains every operation of the current generation, it starts the next one */
+    if (!write_snapshot(t, snapshot, log->generation + 1, log->options.sync))
+        return false;
+
+    pthread_mutex_lock(&log->lock);
+    while (log->writing || log->length > 0)
+        pthread_cond_wait(&log->done, &log->lock);
+    int error = 0;
+    int fd = create_log(log->filename, log->generation + 1, log->options.sync);
+    if (fd >= 0) {
+        close(log->fd);
+        log->fd = fd;
+        ++log->generation;
+        log->offset = sizeof(WalHeader);
+        log->records = 0;
+    }
+    else {
+        error = errno;
+        if (!log->error)
+            log->error = error;
+    }
+    pthread_mutex_unlock(&log->lock);
+    if (error)
+        errno = error;
+    return !error;
+}
+
+/*------------------------  Recovery  -----------------------------*/
+
+typedef struct {
+    ptrBinarySearchTree* tree;
+    bool multiset;
+    unsigned long long replayed;
+} Replay;
+
+static void replay_record(const WalRecord* r, void* env) {
+    Replay* replay = env;
+    if (r->type == record_add) {
+        if (replay->multiset)
+            bstree_multiset_add(replay->tree, r->key);
+        else
+            bstree_add(replay->tree, r->key);
+    }
+    else {
+        if (replay->multiset)
+            bstree_multiset_remove(replay->tree, r->key);
+        else
+            bstree_remove(replay->tree, r->key);
+    }
+    ++replay->replayed;
+}
+
+/* Loads the snapshot in t and returns its generation, 0 for a missing snapshot or one without generation */
+static uint64_t load_snapshot(const char* filename, ptrBinarySearchTree* t, bool multiset, WalRecovery* stats) {
+    FILE* input = filename ? fopen(filename, "r") : NULL;
+    if (!input)
+        return 0;
+    unsigned long long generation = 0;
+    if (fscanf(input, "generation %llu", &generation) != 1)
+        generation = 0;
+    BSTreeKey key;
+    unsigned int count;
+    while (fscanf(input, "%" BSTREE_KEY_FORMAT " %u", &key, &count) == 2) {
+        if (multiset)
+            bstree_multiset_add_occurrences(t, key, count);
+        else
+            bstree_add(t, key);
+        ++stats->snapshot_keys;
+    }
+    fclose(input);
+    return generation;
+}
+
+WalRecovery wal_recover(const char* snapshot, const char* filename, ptrBinarySearchTree* t, bool multiset) {
+    WalRecovery stats = { 0, 0, false, 0, 0. };
+    double start = now();
+    uint64_t generation = load_snapshot(snapshot, t, multiset, &stats);
+    stats.generation = generation;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        WalHeader header;
+        bool truncated;
+        Replay replay = { t, multiset, 0 };
+        /* A log older than the snapshot is already contained in it : the crash happened during a checkpoint */
+        if (pread(fd, &header, sizeof(WalHeader), 0) == (ssize_t)sizeof(WalHeader) &&
+            memcmp(header.magic, wal_magic, sizeof(wal_magic)) == 0 && header.generation >= generation) {
+            scan_log(fd, &header, replay_record, &replay, &truncated);
+            stats.truncated = truncated;
+        }
+        stats.replayed = replay.replayed;
+        close(fd);
+    }
+    stats.seconds = now() - start;
+    return stats;
+}
@@ -0,0 +1,121 @@
+/*-----------------------------------------------------------------*/
+/*
+ Licence Informatique - Structures de données
+
+ Write-ahead log of the mutations of a BinarySearchTree.
+ */
+/*-----------------------------------------------------------------*/
+#ifndef __WAL__H__
+#define __WAL__H__
+#include "bstree.h"
+
+/** \defgroup WriteAheadLog Durable trees with a write-ahead log.
+ * @{
+ * A WriteAheadLog records the additions and removals applied to a tree in an append-only file, so that the
+ * tree can be rebuilt after the process dies.
+ *
+ * Logging an operation only copies a record into a memory buffer. A background thread writes the pending
+ * records and flushes them to the disk with one fdatasync for the whole group, at most flush_interval seconds
+ * after they were logged. The operations logged during this window may be lost by a crash, wal_sync waits
+ * until everything logged so far is on the disk.
+ *
+ * A checkpoint writes a snapshot of the tree and starts a new generation of the log, so that the time needed to
+ * recover is bounded by the size of the tree and the operations logged since the last checkpoint. The snapshot
+ * has one line "key count" per key, in increasing order, after a first line giving its generation.
+ *
+ * The records are in the byte order of the machine, the log can only be replayed on the same architecture and
+ * with the same size of keys, see BSTreeKey.
+ */
+
+/** Parameters of the log. */
+typedef struct {
+    /** maximum number of seconds between the logging of an operation and its flush to the disk. */
+    double flush_interval;
+    /** number of records buffered in memory, a full buffer is written without waiting for the interval. */
+    size_t buffer_records;
+    /** if false, the records are written but fdatasync is never called : only a crash of the process, not of the
+     * system, is survived. */
+    bool sync;
+} WalOptions;
+
+/** Statistics of a recovery. */
+typedef struct {
+    /** number of keys read from the snapshot. */
+    unsigned long long snapshot_keys;
+    /** number of records of the log applied to the tree. */
+    unsigned long long replayed;
+    /** true if the log ended with an incomplete or corrupted record, which was ignored. */
+    bool truncated;
+    /** generation of the snapshot, 0 without snapshot : the log must be opened with it, see wal_open. */
+    unsigned long long generation;
+    /** duration of the recovery, in seconds. */
+    double seconds;
+} WalRecovery;
+
+/** Opaque definition of the type WriteAheadLog */
+typedef struct s_wal WriteAheadLog;
+typedef WriteAheadLog* ptrWriteAheadLog;
+
+/** Constructor : fills the options with default values.
+ * Flush every 10 ms, buffers of 64K records, fdatasync enabled.
+ */
+void wal_default_options(WalOptions* options);
+
+/** Constructor : opens the log filename for appending, creating it if needed, and starts its writer thread.
+ * A log left by a crash must be replayed with wal_recover before being opened : its incomplete last record, if
+ * any, is removed. A log older than generation, left by a crash during a checkpoint, is already contained in the
+ * snapshot : it is replaced by an empty log of this generation.
+ * @param generation the generation of the snapshot the log follows, given by wal_recover, 0 without snapshot.
+ * @param options the options of the log, NULL for the default options.
+ * @return the log, or NULL if the file cannot be opened, errno then gives the reason.
+ */
+WriteAheadLog* wal_open(const char* filename, unsigned long long generation, const WalOptions* options);
+
+/** Destructor : writes and flushes the pending records, stops the writer thread and closes the log.
+ * @pre no other thread uses the log.
+ */
+void wal_close(ptrWriteAheadLog* log);
+
+/** Operator : logs the addition of v, or of one occurrence of v for a multiset.
+ * Thread safe. Only blocks when the writer thread is late by a full buffer.
+ */
+void wal_log_add(WriteAheadLog* log, BSTreeKey v);
+
+/** Operator : logs the removal of v, or of one occurrence of v for a multiset.
+ * Thread safe. Only blocks when the writer thread is late by a full buffer.
+ */
+void wal_log_remove(WriteAheadLog* log, BSTreeKey v);
+
+/** Operator : waits until all the operations logged so far are written and flushed.
+ * @return false if the log could not be written, errno then gives the reason.
+ */
+bool wal_sync(WriteAheadLog* log);
+
+/** Operator : number of operations logged since the last checkpoint, to decide when to checkpoint.
+ */
+unsigned long long wal_records(WriteAheadLog* log);
+
+/** Operator : number of fdatasync calls done by the writer thread, each one commits a group of records.
+ */
+unsigned long long wal_groups(WriteAheadLog* log);
+
+/** Operator : writes a snapshot of t in the file snapshot then empties the log.
+ * The snapshot, then the empty log of the next generation, are written under a temporary name, flushed and
+ * renamed : a crash at any time leaves either the previous snapshot and the full log, or the new snapshot with
+ * the old log, which is ignored, or the new snapshot and the new log.
+ * @pre t contains all the operations logged, and no operation is logged during the checkpoint.
+ * @return true if the checkpoint was done.
+ */
+bool wal_checkpoint(WriteAheadLog* log, const BinarySearchTree* t, const char* snapshot);
+
+/** Constructor : rebuilds the tree from the snapshot, if it exists, then replays the log filename on top of it.
+ * The operations are applied with bstree_multiset_add and bstree_multiset_remove if multiset is true, with
+ * bstree_add and bstree_remove otherwise.
+ * @param snapshot the snapshot file, NULL or a missing file for an empty initial tree.
+ * @return the statistics of the recovery.
+ */
+WalRecovery wal_recover(const char* snapshot, const char* filename, ptrBinarySearchTree* t, bool multiset);
+
+/** @} */
+
+#endif